@@ -1 +1,78 @@
-#include "container.h"
\ No newline at end of file
+#include "container.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace chaos {
+
+namespace {
+
+constexpr uint32_t kTraceMagic = 0x52544343;  // "CCTR"
+constexpr uint32_t kTraceVersion = 1;
+constexpr size_t kTraceRecordSize = 12;
+constexpr size_t kTraceBufferSize = 64 * 1024;
+// Costs above are clamped, the low bit holds the op.
+constexpr uint32_t kTraceMaxCost = UINT32_MAX >> 1;
+
+}  // namespace
+
+CacheTrace::CacheTrace(const std::string& path)
+    : out_(std::make_unique<std::ofstream>(
+          path, std::ios::binary | std::ios::trunc)) {
+  if (!*out_) {
+    throw std::runtime_error("failed to open " + path + ".");
+  }
+  const uint32_t header[2] = {kTraceMagic, kTraceVersion};
+  out_->write(reinterpret_cast<const char*>(header), sizeof(header));
+  buffer_.reserve(kTraceBufferSize);
+}
+
+CacheTrace::~CacheTrace() { flush(); }
+
+void CacheTrace::record(Op op, uint64_t key, size_t cost) {
+  const uint32_t word =
+      ((uint32_t)std::min<size_t>(cost, kTraceMaxCost) << 1) | (uint32_t)op;
+  uint8_t record[kTraceRecordSize];
+  ::memcpy(record, &key, sizeof(key));
+  ::memcpy(record + sizeof(key), &word, sizeof(word));
+
+  std::lock_guard lock(mutex_);
+  buffer_.insert(buffer_.end(), record, record + kTraceRecordSize);
+  if (buffer_.size() + kTraceRecordSize > kTraceBufferSize) {
+    out_->write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+    buffer_.clear();
+  }
+}
+
+void CacheTrace::flush() {
+  std::lock_guard lock(mutex_);
+  out_->write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+  out_->flush();
+  buffer_.clear();
+}
+
+std::vector<CacheTrace::Access> CacheTrace::load(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  uint32_t header[2] = {};
+  in.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!in || header[0] != kTraceMagic || header[1] != kTraceVersion) {
+    throw std::runtime_error("not a cache trace: " + path + ".");
+  }
+
+  std::vector<Access> accesses;
+  uint8_t record[kTraceRecordSize];
+  // A record cut short by a crash ends the trace.
+  while (in.read(reinterpret_cast<char*>(record), kTraceRecordSize)) {
+    Access access;
+    uint32_t word;
+    ::memcpy(&access.key, record, sizeof(access.key));
+    ::memcpy(&word, record + sizeof(access.key), sizeof(word));
+    access.cost = word >> 1;
+    access.op = (Op)(word & 1);
+    accesses.push_back(access);
+  }
+  return accesses;
+}
+
+}  // namespace chaos
@@ -1,11 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <functional>
-#include <list>
+#include <iosfwd>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
+#include <shared_mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace chaos {
 
@@ -25,17 +35,507 @@ class HistoryList {
   std::deque<T> forward_;
 };
 
-template <typename key_t, typename value_t>
+namespace detail {
+
+// Index-linked lists over a cache's node array, one per policy segment, each
+// ordered from most to least recently used.
+class SegmentedList {
+ public:
+  static constexpr uint32_t kNil = UINT32_MAX;
+  static constexpr int kSegments = 3;
+
+  SegmentedList() : segments_(), cost_(0), size_(0) {
+    for (Segment& segment : segments_) {
+      segment = {kNil, kNil, 0};
+    }
+  }
+
+  void resize(size_t count) { links_.resize(count); }
+  void reserve(size_t count) { links_.reserve(count); }
+
+  size_t size() const { return size_; }
+  size_t cost() const { return cost_; }
+  size_t cost(int segment) const { return segments_[segment].cost; }
+  size_t cost(uint32_t index) const { return links_[index].cost; }
+  size_t hash(uint32_t index) const { return links_[index].hash; }
+  int segment(uint32_t index) const { return links_[index].segment; }
+  uint32_t front(int segment) const { return segments_[segment].head; }
+  uint32_t back(int segment) const { return segments_[segment].tail; }
+
+  void pushFront(int segment, uint32_t index, size_t hash, size_t cost) {
+    links_[index].hash = hash;
+    links_[index].cost = cost;
+    link(segment, index);
+    cost_ += cost;
+    size_++;
+  }
+
+  void remove(uint32_t index) {
+    unlink(index);
+    cost_ -= links_[index].cost;
+    size_--;
+  }
+
+  void moveToFront(int segment, uint32_t index) {
+    unlink(index);
+    link(segment, index);
+  }
+
+  void setCost(uint32_t index, size_t cost) {
+    Link& l = links_[index];
+    segments_[l.segment].cost = segments_[l.segment].cost - l.cost + cost;
+    cost_ = cost_ - l.cost + cost;
+    l.cost = cost;
+  }
+
+  // Walks all segments in order, kNil past either end.
+  uint32_t first() const { return firstFrom(0); }
+  uint32_t last() const { return lastFrom(kSegments - 1); }
+  uint32_t after(uint32_t index) const {
+    const Link& l = links_[index];
+    return l.next != kNil ? l.next : firstFrom(l.segment + 1);
+  }
+  uint32_t before(uint32_t index) const {
+    if (index == kNil) {
+      return last();
+    }
+    const Link& l = links_[index];
+    return l.prev != kNil ? l.prev : lastFrom(l.segment - 1);
+  }
+
+ private:
+  struct Link {
+    uint32_t prev;
+    uint32_t next;
+    int segment;
+    size_t hash;
+    size_t cost;
+  };
+  struct Segment {
+    uint32_t head;
+    uint32_t tail;
+    size_t cost;
+  };
+
+  uint32_t firstFrom(int segment) const {
+    for (; segment < kSegments; ++segment) {
+      if (segments_[segment].head != kNil) {
+        return segments_[segment].head;
+      }
+    }
+    return kNil;
+  }
+
+  uint32_t lastFrom(int segment) const {
+    for (; segment >= 0; --segment) {
+      if (segments_[segment].tail != kNil) {
+        return segments_[segment].tail;
+      }
+    }
+    return kNil;
+  }
+
+  void link(int segment, uint32_t index) {
+    Segment& s = segments_[segment];
+    Link& l = links_[index];
+    l.segment = segment;
+    l.prev = kNil;
+    l.next = s.head;
+    if (s.head != kNil) {
+      links_[s.head].prev = index;
+    }
+    s.head = index;
+    if (s.tail == kNil) {
+      s.tail = index;
+    }
+    s.cost += l.cost;
+  }
+
+  void unlink(uint32_t index) {
+    Link& l = links_[index];
+    Segment& s = segments_[l.segment];
+    (l.prev != kNil ? links_[l.prev].next : s.head) = l.next;
+    (l.next != kNil ? links_[l.next].prev : s.tail) = l.prev;
+    s.cost -= l.cost;
+  }
+
+  std::vector<Link> links_;
+  std::array<Segment, kSegments> segments_;
+  size_t cost_;
+  size_t size_;
+};
+
+// Count-min sketch of 4-bit saturating counters, four rows. Counters are
+// halved every 10 * width increments so old popularity fades.
+class CountMinSketch {
+ public:
+  CountMinSketch() : mask_(0), additions_(0) {}
+
+  // Sized for about |count| distinct keys, resizing forgets all counts.
+  void ensureCapacity(size_t count) {
+    const size_t width = std::bit_ceil(std::max<size_t>(count, 64));
+    if (width > mask_ + 1 || table_.empty()) {
+      table_.assign(width * kRows, 0);
+      mask_ = width - 1;
+      additions_ = 0;
+    }
+  }
+
+  void increment(size_t hash) {
+    if (table_.empty()) {
+      return;
+    }
+    bool added = false;
+    for (int row = 0; row < kRows; ++row) {
+      uint8_t& counter = table_[index(hash, row)];
+      if (counter < 15) {
+        counter++;
+        added = true;
+      }
+    }
+    if (added && ++additions_ >= 10 * (mask_ + 1)) {
+      for (uint8_t& counter : table_) {
+        counter >>= 1;
+      }
+      additions_ /= 2;
+    }
+  }
+
+  int frequency(size_t hash) const {
+    if (table_.empty()) {
+      return 0;
+    }
+    int frequency = 15;
+    for (int row = 0; row < kRows; ++row) {
+      frequency = std::min<int>(frequency, table_[index(hash, row)]);
+    }
+    return frequency;
+  }
+
+ private:
+  static constexpr int kRows = 4;
+
+  size_t index(size_t hash, int row) const {
+    static constexpr uint64_t kSeeds[kRows] = {0x9e3779b97f4a7c15ULL,
+        0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL, 0xd6e8feb86659fd93ULL};
+    uint64_t h = ((uint64_t)hash + kSeeds[row]) * kSeeds[(row + 1) % kRows];
+    h ^= h >> 32;
+    return row * (mask_ + 1) + (h & mask_);
+  }
+
+  std::vector<uint8_t> table_;
+  size_t mask_;
+  size_t additions_;
+};
+
+}  // namespace detail
+
+// Eviction policies for LRUCache. A policy places entries into the segments
+// of a detail::SegmentedList and picks the victim while the cache is over
+// capacity; the cache then removes it.
+//
+// Plain least recently used.
+struct LRUPolicy {
+  using list_t = detail::SegmentedList;
+
+  void access(size_t /*hash*/) {}
+  void insert(list_t& list, uint32_t index, size_t hash, size_t cost,
+      size_t /*capacity*/) {
+    list.pushFront(0, index, hash, cost);
+  }
+  void hit(list_t& list, uint32_t index, size_t /*capacity*/) {
+    list.moveToFront(0, index);
+  }
+  uint32_t victim(list_t& list, size_t /*capacity*/) { return list.back(0); }
+};
+
+// 2Q: new entries wait in a FIFO taking a quarter of the capacity. Entries
+// only reach the main LRU when they are requested again shortly after they
+// were evicted from the FIFO, which a ghost table of evicted key hashes
+// remembers. A one-off scan churns through the FIFO only.
+struct TwoQueuePolicy {
+  using list_t = detail::SegmentedList;
+  static constexpr int kMain = 0;
+  static constexpr int kIn = 1;
+
+  void access(size_t /*hash*/) {}
+
+  void insert(list_t& list, uint32_t index, size_t hash, size_t cost,
+      size_t /*capacity*/) {
+    // Remembers about as many keys as the cache holds.
+    const size_t count = std::bit_ceil(std::max<size_t>(list.size() * 2, 64));
+    if (ghosts_.size() < count) {
+      ghosts_.assign(count, 0);
+    }
+    // Tagged with the low bit so a zero hash differs from an empty slot.
+    size_t& ghost = ghosts_[hash & (ghosts_.size() - 1)];
+    if (ghost == (hash | 1)) {
+      ghost = 0;
+      list.pushFront(kMain, index, hash, cost);
+    } else {
+      list.pushFront(kIn, index, hash, cost);
+    }
+  }
+
+  void hit(list_t& list, uint32_t index, size_t /*capacity*/) {
+    if (list.segment(index) == kMain) {
+      list.moveToFront(kMain, index);
+    }
+  }
+
+  uint32_t victim(list_t& list, size_t capacity) {
+    if (list.back(kIn) != list_t::kNil &&
+        (list.cost(kIn) > capacity / 4 || list.back(kMain) == list_t::kNil)) {
+      const uint32_t index = list.back(kIn);
+      // Lossy, a colliding hash replaces the older ghost.
+      ghosts_[list.hash(index) & (ghosts_.size() - 1)] = list.hash(index) | 1;
+      return index;
+    }
+    return list.back(kMain);
+  }
+
+ private:
+  std::vector<size_t> ghosts_;
+};
+
+// W-TinyLFU: a small LRU window (1%) in front of a segmented LRU main area
+// split into probation and protected (80%). An entry leaving the window only
+// enters the main area when a count-min sketch of recent accesses rates it
+// above the main area's next victim, so a scan cannot flush frequently used
+// entries.
+struct TinyLFUPolicy {
+  using list_t = detail::SegmentedList;
+  static constexpr int kWindow = 0;
+  static constexpr int kProbation = 1;
+  static constexpr int kProtected = 2;
+
+  void access(size_t hash) { sketch_.increment(hash); }
+
+  void insert(list_t& list, uint32_t index, size_t hash, size_t cost,
+      size_t capacity) {
+    sketch_.ensureCapacity(list.size() + 1);
+    list.pushFront(kWindow, index, hash, cost);
+    // Overflowing the window is free while the main area has room.
+    while (list.cost(kWindow) > window(capacity) && list.cost() <= capacity) {
+      list.moveToFront(kProbation, list.back(kWindow));
+    }
+  }
+
+  void hit(list_t& list, uint32_t index, size_t capacity) {
+    if (list.segment(index) == kWindow) {
+      list.moveToFront(kWindow, index);
+      return;
+    }
+    list.moveToFront(kProtected, index);
+    const size_t main = capacity - std::min(capacity, window(capacity));
+    while (list.cost(kProtected) > main - main / 5 &&
+           list.back(kProtected) != index) {
+      list.moveToFront(kProbation, list.back(kProtected));
+    }
+  }
+
+  uint32_t victim(list_t& list, size_t capacity) {
+    for (;;) {
+      const uint32_t candidate = list.cost(kWindow) > window(capacity)
+                                     ? list.back(kWindow)
+                                     : list_t::kNil;
+      uint32_t main = list.back(kProbation);
+      if (main == list_t::kNil) {
+        main = list.back(kProtected);
+      }
+      if (candidate == list_t::kNil) {
+        return main != list_t::kNil ? main : list.back(kWindow);
+      }
+      if (main == list_t::kNil) {
+        list.moveToFront(kProbation, candidate);
+        continue;
+      }
+      // The admission duel, the loser is evicted.
+      if (sketch_.frequency(list.hash(candidate)) >
+          sketch_.frequency(list.hash(main))) {
+        list.moveToFront(kProbation, candidate);
+        return main;
+      }
+      return candidate;
+    }
+  }
+
+ private:
+  static size_t window(size_t capacity) {
+    return std::max<size_t>(1, capacity / 100);
+  }
+
+  detail::CountMinSketch sketch_;
+};
+
+// Common report of the caches.
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  // Lookups of entries still being produced, counted as neither hits nor
+  // misses.
+  uint64_t pending = 0;
+  size_t entries = 0;
+  // Resident cost, bytes when entries are weighed in bytes.
+  size_t bytes = 0;
+  // Mean time since the resident entries were put.
+  std::chrono::duration<double> mean_age{};
+
+  double hitRate() const {
+    return hits + misses > 0 ? (double)hits / (double)(hits + misses) : 0.0;
+  }
+
+  // Merges the stats of e.g. another shard.
+  CacheStats& operator+=(const CacheStats& other) {
+    if (entries + other.entries > 0) {
+      mean_age = (mean_age * (double)entries +
+                     other.mean_age * (double)other.entries) /
+                 (double)(entries + other.entries);
+    }
+    hits += other.hits;
+    misses += other.misses;
+    evictions += other.evictions;
+    pending += other.pending;
+    entries += other.entries;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+namespace detail {
+
+// Mean age of a set of entries from the sum of their insertion times.
+class AgeTracker {
+ public:
+  static double now() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void add(double time) { sum_ += time; }
+  void remove(double time) { sum_ -= time; }
+  std::chrono::duration<double> mean(size_t count) const {
+    return std::chrono::duration<double>(count ? now() - sum_ / count : 0.0);
+  }
+
+ private:
+  double sum_ = 0.0;
+};
+
+}  // namespace detail
+
+// Compact binary log of cache accesses for offline replay against other
+// capacities and policies, see examples/cachereplay. 12 bytes an access: the
+// key's hash and, for puts, the entry's cost. Thread-safe, one trace may be
+// shared by several caches.
+class CacheTrace {
+ public:
+  enum class Op { Get = 0, Put = 1 };
+  struct Access {
+    uint64_t key;
+    size_t cost;
+    Op op;
+  };
+
+  explicit CacheTrace(const std::string& path);
+  ~CacheTrace();
+
+  CacheTrace(const CacheTrace&) = delete;
+  CacheTrace& operator=(const CacheTrace&) = delete;
+
+  void record(Op op, uint64_t key, size_t cost = 0);
+  void flush();
+
+  static std::vector<Access> load(const std::string& path);
+
+ private:
+  std::mutex mutex_;
+  std::unique_ptr<std::ofstream> out_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Capacity is in cost units. Entries cost 1 unless a cost function is set,
+// e.g. one returning Image::size() turns the capacity into a byte budget.
+// |policy_t| picks what to evict, see LRUPolicy, TwoQueuePolicy and
+// TinyLFUPolicy.
+//
+// Flat layout: entries live in one array and form intrusive lists linked by
+// index, looked up through an open-addressing table of indices. Freed slots
+// are reused, so once the arrays have grown (or after reserve()) operations
+// do not allocate. Values may be move-only.
+template <typename key_t, typename value_t,
+    typename hash_t = std::hash<key_t>, typename policy_t = LRUPolicy>
 class LRUCache {
+  static constexpr uint32_t kNil = detail::SegmentedList::kNil;
+
+  struct Node {
+    std::optional<std::pair<key_t, value_t>> entry;
+    // Next free node for unused nodes.
+    uint32_t next_free;
+    // AgeTracker time of the last put.
+    double put_time;
+  };
+
+  template <bool kConst>
+  class Iterator {
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::pair<key_t, value_t>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<kConst, const value_type*, value_type*>;
+    using reference =
+        std::conditional_t<kConst, const value_type&, value_type&>;
+    using cache_t = std::conditional_t<kConst, const LRUCache*, LRUCache*>;
+
+    Iterator() : cache_(nullptr), index_(kNil) {}
+    Iterator(cache_t cache, uint32_t index) : cache_(cache), index_(index) {}
+    operator Iterator<true>() const { return {cache_, index_}; }
+
+    reference operator*() const { return *cache_->nodes_[index_].entry; }
+    pointer operator->() const { return &*cache_->nodes_[index_].entry; }
+
+    Iterator& operator++() {
+      index_ = cache_->list_.after(index_);
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator it = *this;
+      ++*this;
+      return it;
+    }
+    Iterator& operator--() {
+      index_ = cache_->list_.before(index_);
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator it = *this;
+      --*this;
+      return it;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return index_ == other.index_;
+    }
+
+   private:
+    cache_t cache_;
+    uint32_t index_;
+  };
+
  public:
   using entry_t = std::pair<key_t, value_t>;
-  using iter_t = std::list<entry_t>::iterator;
-  using const_iter_t = std::list<entry_t>::const_iterator;
-  using reverse_iter_t = std::list<entry_t>::reverse_iterator;
-  using const_reverse_iter_t = std::list<entry_t>::const_reverse_iterator;
+  using cost_func_t = std::function<size_t(const key_t&, const value_t&)>;
+  using evict_func_t = std::function<void(const key_t&, const value_t&)>;
+  using iter_t = Iterator<false>;
+  using const_iter_t = Iterator<true>;
+  using reverse_iter_t = std::reverse_iterator<iter_t>;
+  using const_reverse_iter_t = std::reverse_iterator<const_iter_t>;
 
-  LRUCache() : capacity_(SIZE_MAX) {}
-  LRUCache(size_t capacity) : capacity_(capacity) {}
+  LRUCache() : LRUCache(SIZE_MAX) {}
+  LRUCache(size_t capacity)
+      : free_(kNil), shift_(64), capacity_(capacity), stats_() {}
   ~LRUCache() {}
 
   LRUCache(const LRUCache&) = delete;
@@ -44,67 +544,473 @@ class LRUCache {
   LRUCache(LRUCache&&) = default;
   LRUCache& operator=(LRUCache&&) = default;
 
-  bool empty() const { return list_.empty(); }
+  bool empty() const { return list_.size() == 0; }
+  size_t size() const { return list_.size(); }
 
-  entry_t top() const { return (*list_.cbegin()); }
+  entry_t top() const { return *nodes_[list_.first()].entry; }
   
-  iter_t begin() { return list_.begin(); }
-  const_iter_t begin() const { return list_.begin(); }
-  iter_t end() { return list_.end(); }
-  const_iter_t end() const { return list_.end(); }
+  // In segment order, most recently used first within a segment.
+  iter_t begin() { return {this, list_.first()}; }
+  const_iter_t begin() const { return {this, list_.first()}; }
+  iter_t end() { return {this, kNil}; }
+  const_iter_t end() const { return {this, kNil}; }
 
-  reverse_iter_t rbegin() { return list_.rbegin(); }
-  const_reverse_iter_t crbegin() const { return list_.rbegin(); }
-  reverse_iter_t rend() { return list_.rend(); }
-  const_reverse_iter_t crend() const { return list_.rend(); }
+  reverse_iter_t rbegin() { return reverse_iter_t(end()); }
+  const_reverse_iter_t crbegin() const { return const_reverse_iter_t(end()); }
+  reverse_iter_t rend() { return reverse_iter_t(begin()); }
+  const_reverse_iter_t crend() const { return const_reverse_iter_t(begin()); }
 
-  void put(const key_t& key, const value_t& value) {
-    auto it = map_.find(key);
-    if (it != map_.end()) {
-      list_.erase(it->second);
-      map_.erase(key);
+  // Makes room for |count| entries up front. Puts insert before they evict,
+  // so a full cache briefly holds one more.
+  void reserve(size_t count) {
+    nodes_.reserve(count + 1);
+    list_.reserve(count + 1);
+    if ((count + 1) * 2 > slots_.size()) {
+      rehash(std::bit_ceil((count + 1) * 2));
     }
+  }
 
-    list_.push_front(std::make_pair(key, value));
-    map_.insert({key, list_.begin()});
-    clean();
+  void put(const key_t& key, const value_t& value) { emplace(key, value); }
+  void put(const key_t& key, value_t&& value) {
+    emplace(key, std::move(value));
   }
 
   bool get(const key_t& key, value_t& value) {
-    auto it = map_.find(key);
-    if (it == map_.end()) {
+    value_t* found = find(key);
+    if (!found) {
       return false;
     }
-    list_.splice(list_.begin(), list_, it->second);
-    value = it->second->value;
+    value = *found;
+    return true;
+  }
+
+  // As get(), without copying. Null when missing.
+  value_t* find(const key_t& key) {
+    const size_t hash = hash_t()(key);
+    if (trace_) {
+      trace_->record(CacheTrace::Op::Get, hash);
+    }
+    policy_.access(hash);
+    const size_t slot = lookup(key, hash);
+    if (slot == SIZE_MAX) {
+      stats_.misses++;
+      return nullptr;
+    }
+    stats_.hits++;
+    policy_.hit(list_, slots_[slot], capacity_);
+    return &nodes_[slots_[slot]].entry->second;
+  }
+
+  // As get(), without making the entry more recently used or counting
+  // towards the stats.
+  bool peek(const key_t& key, value_t& value) const {
+    const size_t slot = lookup(key, hash_t()(key));
+    if (slot == SIZE_MAX) {
+      return false;
+    }
+    value = nodes_[slots_[slot]].entry->second;
     return true;
   }
 
   size_t capacity() const noexcept { return capacity_; }
+  // Sum of the entries' costs.
+  size_t cost() const noexcept { return list_.cost(); }
 
   void setCapacity(size_t capacity) { 
     capacity_ = capacity; 
     clean();
   }
 
+  // Applies to entries put from now on.
+  void setCostFunction(cost_func_t func) { cost_func_ = std::move(func); }
+
+  // Called with every entry evicted to fit the capacity, after it left the
+  // cache. Owners release e.g. GPU textures of evicted images here.
+  void setEvictionCallback(evict_func_t func) {
+    evict_func_ = std::move(func);
+  }
+
+  // Hits and misses count get() and find().
+  CacheStats stats() const {
+    CacheStats stats = stats_;
+    stats.entries = size();
+    stats.bytes = cost();
+    stats.mean_age = age_.mean(size());
+    return stats;
+  }
+  // Clears the counters.
+  void resetStats() { stats_ = {}; }
+
+  // Logs get(), find() and put() to |trace|, null stops.
+  void setTrace(std::shared_ptr<CacheTrace> trace) {
+    trace_ = std::move(trace);
+  }
+
   void enumerate(std::function<void(const key_t&, const value_t&)> callback) {
-    for (auto entry : list_) {
-      callback(entry.key, entry.value);
+    for (uint32_t i = list_.first(); i != kNil; i = list_.after(i)) {
+      callback(nodes_[i].entry->first, nodes_[i].entry->second);
     }
   }
 
  private:
+  template <typename V>
+  void emplace(const key_t& key, V&& value) {
+    const size_t hash = hash_t()(key);
+    const size_t cost = cost_func_ ? cost_func_(key, value) : 1;
+    if (trace_) {
+      trace_->record(CacheTrace::Op::Put, hash, cost);
+    }
+    const double now = detail::AgeTracker::now();
+    policy_.access(hash);
+    const size_t slot = lookup(key, hash);
+    if (slot != SIZE_MAX) {
+      const uint32_t index = slots_[slot];
+      nodes_[index].entry->second = std::forward<V>(value);
+      age_.remove(nodes_[index].put_time);
+      age_.add(now);
+      nodes_[index].put_time = now;
+      list_.setCost(index, cost);
+      policy_.hit(list_, index, capacity_);
+      clean();
+      return;
+    }
+
+    if ((list_.size() + 1) * 2 > slots_.size()) {
+      rehash(std::max<size_t>(16, slots_.size() * 2));
+    }
+    uint32_t index = free_;
+    if (index != kNil) {
+      free_ = nodes_[index].next_free;
+    } else {
+      index = (uint32_t)nodes_.size();
+      nodes_.emplace_back();
+      list_.resize(nodes_.size());
+    }
+    nodes_[index].entry.emplace(key, std::forward<V>(value));
+    nodes_[index].put_time = now;
+    age_.add(now);
+    policy_.insert(list_, index, hash, cost, capacity_);
+    insertSlot(index);
+    clean();
+  }
+
+  size_t lookup(const key_t& key, size_t hash) const {
+    if (slots_.empty()) {
+      return SIZE_MAX;
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = home(hash); slots_[i] != kNil; i = (i + 1) & mask) {
+      const uint32_t index = slots_[i];
+      if (list_.hash(index) == hash && nodes_[index].entry->first == key) {
+        return i;
+      }
+    }
+    return SIZE_MAX;
+  }
+
+  void insertSlot(uint32_t index) {
+    const size_t mask = slots_.size() - 1;
+    size_t i = home(list_.hash(index));
+    while (slots_[i] != kNil) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = index;
+  }
+
+  // Backward-shift deletion keeps probe sequences intact without tombstones.
+  void eraseSlot(size_t slot) {
+    const size_t mask = slots_.size() - 1;
+    size_t hole = slot;
+    for (size_t i = (slot + 1) & mask; slots_[i] != kNil; i = (i + 1) & mask) {
+      const size_t h = home(list_.hash(slots_[i]));
+      // Move the entry back unless its home lies cyclically in (hole, i].
+      const bool stays =
+          hole <= i ? (hole < h && h <= i) : (hole < h || h <= i);
+      if (!stays) {
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+    slots_[hole] = kNil;
+  }
+
+  // Fibonacci hashing: the top bits of the product depend on all bits of
+  // |hash|, so keys whose hashes differ in few bits, such as integers under
+  // the identity std::hash, do not pile up in neighbouring slots.
+  size_t home(size_t hash) const {
+    return (size_t)(((uint64_t)hash * 0x9e3779b97f4a7c15ULL) >> shift_);
+  }
+
+  void rehash(size_t count) {
+    slots_.assign(count, kNil);
+    shift_ = 64 - std::countr_zero(count);
+    for (uint32_t i = list_.first(); i != kNil; i = list_.after(i)) {
+      insertSlot(i);
+    }
+  }
+
+  // Evicts the policy's victims until the cache fits the capacity, an entry
+  // costing more than the whole capacity does not stay either.
   void clean() {
-    while (map_.size() > capacity_) {
-      map_.erase(list_.back().first);
-      list_.pop_back();
+    while (list_.cost() > capacity_ && list_.size() > 0) {
+      const uint32_t index = policy_.victim(list_, capacity_);
+      Node& node = nodes_[index];
+      eraseSlot(lookup(node.entry->first, list_.hash(index)));
+      list_.remove(index);
+      age_.remove(node.put_time);
+      stats_.evictions++;
+
+      entry_t entry = std::move(*node.entry);
+      node.entry.reset();
+      node.next_free = free_;
+      free_ = index;
+      if (evict_func_) {
+        evict_func_(entry.first, entry.second);
+      }
     }
   }
 
  private:
-  std::list<entry_t> list_;
-  std::unordered_map<key_t, decltype(list_.begin())> map_;
+  std::vector<Node> nodes_;
+  detail::SegmentedList list_;
+  // Node indices, kNil for empty slots. Kept at most half full.
+  std::vector<uint32_t> slots_;
+  uint32_t free_;
+  // 64 - log2 of the slot count.
+  int shift_;
   size_t capacity_;
+  policy_t policy_;
+  CacheStats stats_;
+  detail::AgeTracker age_;
+  cost_func_t cost_func_;
+  evict_func_t evict_func_;
+  std::shared_ptr<CacheTrace> trace_;
+};
+
+// Thread-safe LRUCache split into shards with their own lock and policy.
+// Keys are spread over the shards by hash, each shard evicts on its own share
+// of the capacity.
+template <typename key_t, typename value_t,
+    typename hash_t = std::hash<key_t>, typename policy_t = LRUPolicy>
+class ConcurrentLRUCache {
+  using cache_t = LRUCache<key_t, value_t, hash_t, policy_t>;
+
+ public:
+  explicit ConcurrentLRUCache(size_t capacity = SIZE_MAX, size_t shards = 16)
+      : shards_(new Shard[std::max<size_t>(shards, 1)]),
+        shard_count_(std::max<size_t>(shards, 1)),
+        capacity_(capacity) {
+    setCapacity(capacity);
+  }
+
+  ConcurrentLRUCache(const ConcurrentLRUCache&) = delete;
+  ConcurrentLRUCache& operator=(const ConcurrentLRUCache&) = delete;
+
+  void put(const key_t& key, const value_t& value) {
+    Shard& s = shard(key);
+    std::unique_lock lock(s.mutex);
+    s.cache.put(key, value);
+  }
+
+  bool get(const key_t& key, value_t& value) {
+    Shard& s = shard(key);
+    std::unique_lock lock(s.mutex);
+    return s.cache.get(key, value);
+  }
+
+  // Does not promote the entry, readers of a shard share its lock.
+  bool peek(const key_t& key, value_t& value) const {
+    const Shard& s = shard(key);
+    std::shared_lock lock(s.mutex);
+    return s.cache.peek(key, value);
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::shared_lock lock(shards_[i].mutex);
+      size += shards_[i].cache.size();
+    }
+    return size;
+  }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  size_t cost() const {
+    size_t cost = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::shared_lock lock(shards_[i].mutex);
+      cost += shards_[i].cache.cost();
+    }
+    return cost;
+  }
+
+  // See LRUCache. The eviction callback runs under the shard's lock and must
+  // not call back into the cache.
+  void setCostFunction(
+      typename cache_t::cost_func_t func) {
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::unique_lock lock(shards_[i].mutex);
+      shards_[i].cache.setCostFunction(func);
+    }
+  }
+
+  void setEvictionCallback(
+      typename cache_t::evict_func_t func) {
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::unique_lock lock(shards_[i].mutex);
+      shards_[i].cache.setEvictionCallback(func);
+    }
+  }
+
+  // Merged over the shards.
+  CacheStats stats() const {
+    CacheStats stats;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::shared_lock lock(shards_[i].mutex);
+      stats += shards_[i].cache.stats();
+    }
+    return stats;
+  }
+
+  void setTrace(std::shared_ptr<CacheTrace> trace) {
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::unique_lock lock(shards_[i].mutex);
+      shards_[i].cache.setTrace(trace);
+    }
+  }
+
+  void resetStats() {
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::unique_lock lock(shards_[i].mutex);
+      shards_[i].cache.resetStats();
+    }
+  }
+
+  // Each shard gets an equal share. With few large entries, such as a byte
+  // budget for full-size images, use few shards so one share fits them.
+  void setCapacity(size_t capacity) {
+    capacity_ = capacity;
+    const size_t share = capacity == SIZE_MAX
+                             ? SIZE_MAX
+                             : (capacity + shard_count_ - 1) / shard_count_;
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::unique_lock lock(shards_[i].mutex);
+      shards_[i].cache.setCapacity(share);
+    }
+  }
+
+  // Shard by shard, most recently used first within a shard. |callback| runs
+  // under the shard's lock and must not call back into the cache.
+  void enumerate(std::function<void(const key_t&, const value_t&)> callback) {
+    for (size_t i = 0; i < shard_count_; ++i) {
+      std::unique_lock lock(shards_[i].mutex);
+      shards_[i].cache.enumerate(callback);
+    }
+  }
+
+ private:
+  // Own cache lines, neighbouring shards do not contend.
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mutex;
+    cache_t cache;
+  };
+
+  Shard& shard(const key_t& key) const {
+    // Mix the bits, std::hash of integers may be the identity.
+    uint64_t h = (uint64_t)hash_t()(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return shards_[h % shard_count_];
+  }
+
+  std::unique_ptr<Shard[]> shards_;
+  const size_t shard_count_;
+  std::atomic<size_t> capacity_;
+};
+
+// Bounded lock-free multi-producer multi-consumer queue. Each cell carries a
+// sequence number which tells producers and consumers whose turn it is, so a
+// push or pop is a single CAS on the shared index. |capacity| is rounded up to
+// a power of two.
+template <typename T>
+class MPMCQueue {
+ public:
+  explicit MPMCQueue(size_t capacity)
+      : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+        cells_(new Cell[mask_ + 1]),
+        head_(0),
+        tail_(0) {
+    for (size_t i = 0; i <= mask_; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MPMCQueue(const MPMCQueue&) = delete;
+  MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+  size_t capacity() const noexcept { return mask_ + 1; }
+
+  // |value| is left untouched when the queue is full.
+  bool try_push(T&& value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T& value) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(cell->value);
+    cell->value = T();
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  // Producers and consumers touch different cache lines.
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
 };
 
 }  // namespace chaos
@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <ShlObj_core.h>
 
+#include "base/task.h"
 #include "base/text.h"
 #include "base/win32def.h"
 #include "minlog.h"
@@ -298,7 +299,7 @@ bool FileInfo::sort(SortType sort_type, bool sort_desc) {
     return false;
   }
 
-  std::stable_sort(children_.begin(), children_.end(),
+  task::parallel_sort(children_.begin(), children_.end(),
       std::bind(comparer, std::placeholders::_1, std::placeholders::_2, sort_desc));
 
   for (int i = 0; i < (int)children_.size(); ++i) {
@@ -363,6 +364,56 @@ size_t FileStream::Size() {
   return size.QuadPart;
 }
 
+MappedFile::MappedFile(const std::string& path)
+    : handle_(), mapping_(), data_(), size_() {
+  DWORD share_mode = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+  handle_ = ::CreateFile(path.c_str(), GENERIC_READ, share_mode, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle_ == INVALID_HANDLE_VALUE) {
+    handle_ = NULL;
+    throw std::runtime_error("failed CreateFile().");
+  }
+
+  LARGE_INTEGER size;
+  if (::GetFileSizeEx(handle_, &size) == FALSE) {
+    DWORD error = ::GetLastError();
+    ::CloseHandle(handle_);
+    throw std::runtime_error(error_message(error));
+  }
+  size_ = size.QuadPart;
+  // Empty files cannot be mapped.
+  if (size_ == 0) {
+    return;
+  }
+
+  mapping_ = ::CreateFileMapping(handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping_ == NULL) {
+    DWORD error = ::GetLastError();
+    ::CloseHandle(handle_);
+    throw std::runtime_error(error_message(error));
+  }
+  data_ = static_cast<const uint8_t*>(
+      ::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (data_ == nullptr) {
+    DWORD error = ::GetLastError();
+    ::CloseHandle(mapping_);
+    ::CloseHandle(handle_);
+    throw std::runtime_error(error_message(error));
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::UnmapViewOfFile(data_);
+  }
+  if (mapping_ != NULL) {
+    ::CloseHandle(mapping_);
+  }
+  if (handle_ != NULL) {
+    ::CloseHandle(handle_);
+  }
+}
+
 FileReader::FileReader(const std::string& path, size_t prefetch_size)
     : pos_(0) {
   filestream_ = std::unique_ptr<FileStream>(new FileStream(path));
@@ -102,6 +102,26 @@ class FileStream {
   std::filesystem::path path_;
 };
 
+// Read-only mapping of a whole file. Others may keep appending to or delete
+// the file, the mapping covers its size at construction and stays valid.
+class MappedFile {
+ public:
+  MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* handle_;
+  void* mapping_;
+  const uint8_t* data_;
+  size_t size_;
+};
+
 class FileReader {
  public:
   FileReader(const std::string& path, size_t prefetch_size = 1024 * 1024);
@@ -0,0 +1,198 @@
+#include "profiler.h"
+
+#include <fstream>
+#include <iomanip>
+
+namespace chaos {
+
+namespace profiler {
+
+constexpr size_t kChunkSize = 4096;
+
+struct Event {
+  const char* name;
+  const char* category;
+  int64_t start;
+  int64_t duration;
+};
+
+struct Chunk {
+  Event events[kChunkSize];
+  std::atomic<size_t> count{0};
+  std::atomic<Chunk*> next{nullptr};
+};
+
+// Single producer, single consumer. The owning thread appends to the tail
+// chunk, dump() consumes from the head and frees chunks it is done with.
+// Threads which never record a zone never allocate a chunk.
+struct ThreadBuffer {
+  explicit ThreadBuffer(int tid)
+      : first(nullptr), head(nullptr), tail(nullptr), read(0), tid(tid) {}
+  ~ThreadBuffer() {
+    Chunk* chunk = head ? head : first.load();
+    while (chunk) {
+      delete std::exchange(chunk, chunk->next.load());
+    }
+  }
+
+  bool empty() const { return !head && !first; }
+
+  void push(const Event& event) {
+    if (!tail) {
+      tail = new Chunk;
+      first.store(tail, std::memory_order_release);
+    }
+    size_t count = tail->count.load(std::memory_order_relaxed);
+    if (count == kChunkSize) {
+      Chunk* chunk = new Chunk;
+      tail->next.store(chunk, std::memory_order_release);
+      tail = chunk;
+      count = 0;
+    }
+    tail->events[count] = event;
+    tail->count.store(count + 1, std::memory_order_release);
+  }
+
+  template <typename F>
+  void drain(F&& func) {
+    if (!head && !(head = first.load(std::memory_order_acquire))) {
+      return;
+    }
+    for (;;) {
+      const size_t count = head->count.load(std::memory_order_acquire);
+      for (; read < count; ++read) {
+        func(head->events[read]);
+      }
+      Chunk* next = head->next.load(std::memory_order_acquire);
+      if (read < kChunkSize || !next) {
+        return;
+      }
+      delete std::exchange(head, next);
+      read = 0;
+    }
+  }
+
+  std::atomic<Chunk*> first;
+  Chunk* head;
+  Chunk* tail;
+  size_t read;
+  const int tid;
+  std::string name;
+};
+
+struct Registry {
+  const std::chrono::high_resolution_clock::time_point origin =
+      std::chrono::high_resolution_clock::now();
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  int next_tid = 1;
+};
+
+std::atomic<bool> g_running(false);
+
+// Never destroyed, worker threads of static queues record until exit.
+Registry& registry() {
+  static Registry* registry = new Registry;
+  return *registry;
+}
+
+ThreadBuffer* threadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    Registry& r = registry();
+    std::lock_guard lock(r.mutex);
+    // Exited threads which recorded nothing, elastic pools churn through them.
+    std::erase_if(r.buffers, [](const std::shared_ptr<ThreadBuffer>& buffer) {
+      return buffer.use_count() == 1 && buffer->empty();
+    });
+    auto buffer = std::make_shared<ThreadBuffer>(r.next_tid++);
+    r.buffers.push_back(buffer);
+    return buffer;
+  }();
+  return buffer.get();
+}
+
+void escape(std::ostream& out, const char* str) {
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\') {
+      out << '\\';
+    }
+    out << *str;
+  }
+}
+
+void start() { g_running = true; }
+
+void stop() { g_running = false; }
+
+bool running() { return g_running; }
+
+bool dump(const std::string& path) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    return false;
+  }
+
+  // Chrome expects microseconds.
+  out << std::fixed << std::setprecision(3);
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  const auto separate = [&] {
+    out << (first ? "\n" : ",\n");
+    first = false;
+  };
+
+  Registry& r = registry();
+  std::lock_guard lock(r.mutex);
+  for (const std::shared_ptr<ThreadBuffer>& buffer : r.buffers) {
+    if (!buffer->name.empty()) {
+      separate();
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+          << buffer->tid << ",\"args\":{\"name\":\"";
+      escape(out, buffer->name.c_str());
+      out << "\"}}";
+    }
+    buffer->drain([&](const Event& event) {
+      separate();
+      out << "{\"name\":\"";
+      escape(out, event.name);
+      out << "\",\"cat\":\"";
+      escape(out, event.category);
+      out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+          << ",\"ts\":" << event.start / 1000.0
+          << ",\"dur\":" << event.duration / 1000.0 << "}";
+    });
+  }
+  out << "\n]}\n";
+
+  // Buffers of exited threads are gone once drained.
+  std::erase_if(r.buffers, [](const std::shared_ptr<ThreadBuffer>& buffer) {
+    return buffer.use_count() == 1;
+  });
+  return out.good();
+}
+
+void setThreadName(const std::string& name) {
+  ThreadBuffer* buffer = threadBuffer();
+  std::lock_guard lock(registry().mutex);
+  buffer->name = name;
+}
+
+Zone::Zone(const char* name, const char* category)
+    : Timer(), name_(name), category_(category), active_(g_running) {}
+
+Zone::~Zone() {
+  if (!active_) {
+    return;
+  }
+  const auto end = std::chrono::high_resolution_clock::now();
+  threadBuffer()->push({name_, category_,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          start() - registry().origin)
+          .count(),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start())
+          .count()});
+}
+
+}  // namespace profiler
+
+}  // namespace chaos
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+
+#include "task.h"
+
+// Scoped zones, e.g. PROFILE_ZONE("decode") or PROFILE_ZONE(name, "task").
+// Define CHAOS_DISABLE_PROFILER to compile them out.
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifndef CHAOS_DISABLE_PROFILER
+#define PROFILE_ZONE(...) \
+  ::chaos::profiler::Zone PROFILE_CONCAT(profile_zone_, __LINE__)(__VA_ARGS__)
+#else
+#define PROFILE_ZONE(...) ((void)0)
+#endif
+
+namespace chaos {
+
+namespace profiler {
+
+// Zones are recorded between start() and stop() into per-thread buffers which
+// the owning thread appends to without locking.
+void start();
+void stop();
+bool running();
+
+// Writes the zones recorded so far as Chrome trace-event JSON, viewable in
+// chrome://tracing or Perfetto, and drops them.
+bool dump(const std::string& path);
+
+// Labels the calling thread in the trace.
+void setThreadName(const std::string& name);
+
+// Records the lifetime of the scope as a zone. |name| and |category| are not
+// copied, they must outlive the trace.
+class Zone : public Timer {
+ public:
+  explicit Zone(const char* name, const char* category = "chaos");
+  ~Zone() override;
+
+ private:
+  const char* name_;
+  const char* category_;
+  bool active_;
+};
+
+}  // namespace profiler
+
+}  // namespace chaos
@@ -1,6 +1,19 @@
 #include "task.h"
 
+#include <bit>
+
 #include "minlog.h"
+#include "profiler.h"
+
+#ifdef _WIN32
+#include "win32def.h"
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace chaos {
 
@@ -17,14 +30,282 @@ double Timer::elapsed() const {
   return elapsed.count();
 }
 
+std::chrono::high_resolution_clock::time_point Timer::start() const {
+  return start_;
+}
+
 namespace task {
 
-std::mutex g_dispatch_queue_mutex;
-std::unordered_map<std::string, DispatchQueue> g_dispatch_queue_map;
+// Named dispatch queues. Readers probe an immutable open-addressing table
+// published through an atomic pointer. Creating a queue publishes a grown
+// copy under |mutex|; replaced tables are kept until exit, so readers never
+// see one freed.
+struct DispatchQueueRegistry {
+  struct Slot {
+    size_t hash;
+    DispatchQueue* queue;
+  };
+  struct Table {
+    std::vector<Slot> slots;
+    // In creation order.
+    std::vector<DispatchQueue*> queues;
+
+    DispatchQueue* find(std::string_view id, size_t hash) const {
+      const size_t mask = slots.size() - 1;
+      for (size_t i = hash & mask; slots[i].queue; i = (i + 1) & mask) {
+        if (slots[i].hash == hash && slots[i].queue->name() == id) {
+          return slots[i].queue;
+        }
+      }
+      return nullptr;
+    }
+  };
+
+  DispatchQueue* get(std::string_view id) {
+    const size_t hash = std::hash<std::string_view>()(id);
+    const Table* current = table.load(std::memory_order_acquire);
+    if (DispatchQueue* queue = current ? current->find(id, hash) : nullptr) {
+      return queue;
+    }
+
+    std::lock_guard lock(mutex);
+    current = table.load(std::memory_order_relaxed);
+    if (DispatchQueue* queue = current ? current->find(id, hash) : nullptr) {
+      return queue;
+    }
+
+    names.emplace_back(id);
+    queues.push_back(std::make_unique<DispatchQueue>(names.back().c_str()));
+
+    auto next = std::make_unique<Table>();
+    if (current) {
+      next->queues = current->queues;
+    }
+    next->queues.push_back(queues.back().get());
+    // At most half full keeps probe sequences short.
+    next->slots.resize(std::bit_ceil(std::max<size_t>(
+        16, next->queues.size() * 2)));
+    const size_t mask = next->slots.size() - 1;
+    for (DispatchQueue* queue : next->queues) {
+      const size_t h = std::hash<std::string_view>()(queue->name());
+      size_t i = h & mask;
+      while (next->slots[i].queue) {
+        i = (i + 1) & mask;
+      }
+      next->slots[i] = {h, queue};
+    }
+    table.store(next.get(), std::memory_order_release);
+    tables.push_back(std::move(next));
+    return queues.back().get();
+  }
+
+  const Table* snapshot() const {
+    return table.load(std::memory_order_acquire);
+  }
+
+  std::atomic<const Table*> table{nullptr};
+  std::mutex mutex;
+  // Declared before the queues, tasks may look up queues while the queues
+  // shut down.
+  std::vector<std::unique_ptr<Table>> tables;
+  std::deque<std::string> names;
+  std::vector<std::unique_ptr<DispatchQueue>> queues;
+};
+
+DispatchQueueRegistry g_dispatch_queue_registry;
+
+std::mutex g_main_dispatcher_mutex;
+main_dispatcher_t g_main_dispatcher;
+
+// Bumped by every thread config change, workers compare it with theirs.
+std::atomic<uint64_t> g_thread_config_epoch(1);
+std::atomic<int> g_render_core(-1);
+
+#ifndef _WIN32
+// Linux has no process-wide mask to ask for, threads inherit their creator's.
+// Read at startup, before any thread is pinned.
+const cpu_set_t g_process_affinity = [] {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  ::sched_getaffinity(0, sizeof(set), &set);
+  return set;
+}();
+#endif
+
+std::mutex g_cancellation_group_mutex;
+std::unordered_map<std::string, CancellationToken> g_cancellation_group_map;
+
+CancellationToken::CancellationToken() : state_(std::make_shared<State>()) {
+  state_->cancelled = false;
+}
+
+void CancellationToken::cancel() {
+  std::lock_guard lock(state_->mutex);
+  state_->cancelled = true;
+  for (std::atomic<bool>* flag : state_->running) {
+    *flag = true;
+  }
+}
+
+bool CancellationToken::cancelled() const noexcept {
+  return state_->cancelled;
+}
+
+double Histogram::mean() const {
+  return count > 0 ? (double)sum / (double)count : 0.0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+  const uint64_t rank = (uint64_t)(std::clamp(p, 0.0, 1.0) * (double)count);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += buckets[i];
+    if (seen > rank || seen == count) {
+      return std::min(max, i == 0 ? 0 : ((uint64_t)1 << i) - 1);
+    }
+  }
+  return max;
+}
+
+void Histogram::merge(const Histogram& other) {
+  for (int i = 0; i < kBuckets; ++i) {
+    buckets[i] += other.buckets[i];
+  }
+  count += other.count;
+  sum += other.sum;
+  max = std::max(max, other.max);
+}
+
+namespace detail {
 
-constexpr const char* kDefaultDispatchQueueId = "global";
+void AtomicHistogram::add(uint64_t value) {
+  const int bucket = std::min((int)std::bit_width(value), Histogram::kBuckets - 1);
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
 
-DispatchQueue::Worker::Worker() : cancel(false) {}
+Histogram AtomicHistogram::snapshot() const {
+  Histogram histogram;
+  for (int i = 0; i < Histogram::kBuckets; ++i) {
+    histogram.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  histogram.count = count_.load(std::memory_order_relaxed);
+  histogram.sum = sum_.load(std::memory_order_relaxed);
+  histogram.max = max_.load(std::memory_order_relaxed);
+  return histogram;
+}
+
+void AtomicHistogram::reset() {
+  for (std::atomic<uint64_t>& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+}  // namespace detail
+
+thread_local DispatchQueue::Worker* DispatchQueue::current_worker_ = nullptr;
+thread_local DispatchQueue* DispatchQueue::current_queue_ = nullptr;
+
+bool setCurrentThreadName(const std::string& name) {
+#ifdef _WIN32
+  const int size = ::MultiByteToWideChar(
+      CP_UTF8, 0, name.c_str(), (int)name.size(), NULL, 0);
+  std::wstring wname(size, L'\0');
+  ::MultiByteToWideChar(
+      CP_UTF8, 0, name.c_str(), (int)name.size(), wname.data(), size);
+  return SUCCEEDED(::SetThreadDescription(::GetCurrentThread(), wname.c_str()));
+#else
+  // Linux limits names to 15 characters.
+  return ::pthread_setname_np(::pthread_self(), name.substr(0, 15).c_str()) ==
+         0;
+#endif
+}
+
+bool setCurrentThreadAffinity(uint64_t mask) {
+#ifdef _WIN32
+  DWORD_PTR process_mask = 0;
+  DWORD_PTR system_mask = 0;
+  if (!::GetProcessAffinityMask(
+          ::GetCurrentProcess(), &process_mask, &system_mask)) {
+    return false;
+  }
+  const DWORD_PTR thread_mask =
+      mask ? (DWORD_PTR)mask & process_mask : process_mask;
+  return thread_mask != 0 &&
+         ::SetThreadAffinityMask(::GetCurrentThread(), thread_mask) != 0;
+#else
+  cpu_set_t set = g_process_affinity;
+  if (mask) {
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (i >= 64 || !((mask >> i) & 1)) {
+        CPU_CLR(i, &set);
+      }
+    }
+  }
+  return CPU_COUNT(&set) > 0 &&
+         ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+bool setCurrentThreadPriority(ThreadPriority priority) {
+#ifdef _WIN32
+  // EcoQoS steers threads to efficiency cores on hybrid CPUs.
+  THREAD_POWER_THROTTLING_STATE throttling{};
+  throttling.Version = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+  // EcoQoS for Background, opted out for High, up to the OS otherwise.
+  if (priority == ThreadPriority::Background ||
+      priority == ThreadPriority::High) {
+    throttling.ControlMask = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+  }
+  throttling.StateMask = priority == ThreadPriority::Background
+                             ? THREAD_POWER_THROTTLING_EXECUTION_SPEED
+                             : 0;
+  ::SetThreadInformation(::GetCurrentThread(), ThreadPowerThrottling,
+      &throttling, sizeof(throttling));
+
+  int value = THREAD_PRIORITY_NORMAL;
+  if (priority == ThreadPriority::Background) {
+    value = THREAD_PRIORITY_LOWEST;
+  } else if (priority == ThreadPriority::Low) {
+    value = THREAD_PRIORITY_BELOW_NORMAL;
+  } else if (priority == ThreadPriority::High) {
+    value = THREAD_PRIORITY_ABOVE_NORMAL;
+  }
+  return ::SetThreadPriority(::GetCurrentThread(), value) != FALSE;
+#else
+  // Threads have their own nice value on Linux.
+  int nice = 0;
+  if (priority == ThreadPriority::Background) {
+    nice = 19;
+  } else if (priority == ThreadPriority::Low) {
+    nice = 10;
+  } else if (priority == ThreadPriority::High) {
+    nice = -5;
+  }
+  return ::setpriority(PRIO_PROCESS, (id_t)::syscall(SYS_gettid), nice) == 0;
+#endif
+}
+
+void setRenderCore(int core) {
+  if (core >= 64) {
+    throw std::invalid_argument("render core out of range.");
+  }
+  g_render_core = core;
+  setCurrentThreadAffinity(core >= 0 ? (uint64_t)1 << core : 0);
+  g_thread_config_epoch++;
+}
+
+int renderCore() { return g_render_core; }
+
+DispatchQueue::Worker::Worker() : cancel(false), index(0), configured(0) {}
 
 DispatchQueue::Worker::~Worker() {
   if (thread.joinable()) {
@@ -32,108 +313,968 @@ DispatchQueue::Worker::~Worker() {
   }
 }
 
-DispatchQueue::DispatchQueue() : exit_(false) {
-  setThreadCount(1);
+DispatchQueue::DispatchQueue(const char* name)
+    : name_(name),
+      ring_(nullptr),
+      seq_(0),
+      mode_(SchedulingMode::Priority),
+      aging_(),
+      ordered_(false),
+      missed_deadlines_(0),
+      retired_completed_(0),
+      cancelled_(0),
+      retired_time_(0),
+      stats_epoch_(
+          std::chrono::steady_clock::now().time_since_epoch().count()),
+      thread_count_(0),
+      min_threads_(1),
+      max_threads_(1),
+      scale_depth_(4),
+      scale_latency_(std::chrono::steady_clock::duration(
+          std::chrono::milliseconds(50)).count()),
+      idle_timeout_(std::chrono::steady_clock::duration(
+          std::chrono::seconds(5)).count()),
+      exit_(false),
+      queued_tasks_(0),
+      pending_tasks_(0),
+      priority_tasks_(0),
+      sleeping_threads_(0),
+      next_worker_(0),
+      live_threads_(0) {
+  // The first worker is spawned by the first task, once the queue is named.
 }
 
 DispatchQueue::~DispatchQueue() {
-  exit_ = true;
+  {
+    std::lock_guard lock(mutex_);
+    exit_ = true;
+  }
   cv_.notify_all();
-  for (Worker& w : workers_) {
-    if (w.thread.joinable()) {
-      w.thread.join();
-    }
+  cv_idle_.notify_all();
+
+  // Join outside of the lock, exiting workers may still be stealing.
+  std::vector<std::unique_ptr<Worker>> workers;
+  {
+    std::unique_lock lock(workers_mutex_);
+    workers = std::move(workers_);
   }
+  workers.clear();
+
+  // Retired workers were detached and may still be on their way out.
+  {
+    std::unique_lock lock(mutex_);
+    cv_idle_.wait(lock, [this] { return live_threads_ == 0; });
+  }
+  delete ring_.load();
 }
 
 void DispatchQueue::cancel() {
-  std::unique_lock lock(mutex_);
-  pq_ = {};
-  for (Worker& w : workers_) {
-    w.cancel = true;
+  // Destroy dropped tasks outside of the locks, their captures may enqueue.
+  std::vector<Entry> dropped;
+  {
+    std::lock_guard lock(mutex_);
+    std::move(pq_.begin(), pq_.end(), std::back_inserter(dropped));
+    pq_.clear();
+    priority_tasks_ = 0;
+  }
+  {
+    std::shared_lock workers_lock(workers_mutex_);
+    for (const std::unique_ptr<Worker>& w : workers_) {
+      std::lock_guard lock(w->mutex);
+      std::move(w->tasks.begin(), w->tasks.end(), std::back_inserter(dropped));
+      w->tasks.clear();
+      w->cancel = true;
+    }
+  }
+  if (MPMCQueue<Entry>* ring = ring_.load(std::memory_order_acquire)) {
+    Entry entry;
+    while (ring->try_pop(entry)) {
+      dropped.push_back(std::move(entry));
+    }
   }
+
+  queued_tasks_ -= (int)dropped.size();
+  cancelled_ += dropped.size();
+  finish((int)dropped.size());
 }
 
 void DispatchQueue::wait() {
   std::unique_lock lock(mutex_);
-  cv_.wait(
-      lock, [&] { return (exit_ || pq_.empty()) && (running_threads_ <= 0); });
+  cv_idle_.wait(lock, [&] { return exit_ || pending_tasks_ <= 0; });
 }
 
 void DispatchQueue::enqueue(Task&& task) {
+  pending_tasks_++;
+
+  Entry entry{0, 0, 0, std::chrono::steady_clock::now(), std::move(task)};
+  bool lane = useLane(entry.task);
+  if (!lane) {
+    // Hold the list until the push is done so the worker cannot retire
+    // in between.
+    std::shared_lock workers_lock(workers_mutex_);
+    if (workers_.empty()) {
+      lane = true;
+    } else {
+      // Tasks spawned by our own workers stay local, others are spread out.
+      Worker* w = current_queue_ == this
+                      ? current_worker_
+                      : workers_[next_worker_++ % workers_.size()].get();
+      std::lock_guard lock(w->mutex);
+      w->tasks.push_back(std::move(entry));
+    }
+  }
+  if (lane) {
+    pushPriority(std::move(entry));
+  }
+
+  queued_tasks_++;
+  scale();
+  wake();
+}
+
+void DispatchQueue::enqueueBulk(std::span<Task> tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  const int count = (int)tasks.size();
+  pending_tasks_ += count;
+
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<Entry> lane;
   {
+    std::shared_lock workers_lock(workers_mutex_);
+    std::vector<Entry> local;
+    for (Task& task : tasks) {
+      const bool prioritized = useLane(task) || workers_.empty();
+      (prioritized ? lane : local)
+          .push_back({0, 0, 0, now, std::move(task)});
+    }
+
+    // One contiguous run per worker, each worker lock is taken once.
+    const size_t workers = workers_.size();
+    const size_t run = workers > 0 ? (local.size() + workers - 1) / workers : 0;
+    const unsigned int first = next_worker_++;
+    for (size_t i = 0; i < local.size(); i += run) {
+      Worker* w = workers_[(first + i / run) % workers].get();
+      std::lock_guard lock(w->mutex);
+      const size_t last = std::min(local.size(), i + run);
+      std::move(local.begin() + i, local.begin() + last,
+          std::back_inserter(w->tasks));
+    }
+  }
+
+  if (!lane.empty()) {
     std::lock_guard lock(mutex_);
-    pq_.push(std::move(task));
+    for (Entry& entry : lane) {
+      entry.seq = seq_++;
+      updateKey(entry);
+      pq_.push_back(std::move(entry));
+      std::push_heap(pq_.begin(), pq_.end(), Comparer());
+    }
+    priority_tasks_ += (int)lane.size();
+  }
+
+  queued_tasks_ += count;
+  scale();
+  wake(count);
+}
+
+void DispatchQueue::submit(Task&& task) {
+  MPMCQueue<Entry>* ring = ring_.load(std::memory_order_acquire);
+  if (!ring || useLane(task)) {
+    enqueue(std::move(task));
+    return;
+  }
+
+  Entry entry{0, 0, 0, std::chrono::steady_clock::now(), std::move(task)};
+  pending_tasks_++;
+  if (!ring->try_push(std::move(entry))) {
+    pending_tasks_--;
+    enqueue(std::move(entry.task));
+    return;
+  }
+  queued_tasks_++;
+  scale();
+  wake();
+}
+
+void DispatchQueue::setSubmissionRing(size_t capacity) {
+  auto ring = std::make_unique<MPMCQueue<Entry>>(capacity);
+  MPMCQueue<Entry>* expected = nullptr;
+  if (ring_.compare_exchange_strong(expected, ring.get())) {
+    ring.release();
   }
-  cv_.notify_one();
 }
 
 void DispatchQueue::setThreadCount(int size) {
-  wait();
+  setThreadRange(size, size,
+      std::chrono::steady_clock::duration(idle_timeout_.load()));
+}
+
+void DispatchQueue::setThreadRange(int min_threads, int max_threads,
+    std::chrono::steady_clock::duration idle_timeout) {
+  min_threads_ = std::max(0, min_threads);
+  max_threads_ = std::max({1, min_threads, max_threads});
+  idle_timeout_ = idle_timeout.count();
 
+  // Surplus workers retire once they are done with their current task.
   {
     std::lock_guard lock(mutex_);
-    exit_ = true;
   }
   cv_.notify_all();
-  workers_.clear();
 
+  while (thread_count_ < min_threads_ && spawn()) {
+  }
+}
+
+void DispatchQueue::setScaleThreshold(
+    int depth, std::chrono::steady_clock::duration latency) {
+  scale_depth_ = std::max(0, depth);
+  scale_latency_ = latency.count();
+}
+
+void DispatchQueue::setSchedulingMode(
+    SchedulingMode mode, std::chrono::steady_clock::duration aging) {
+  std::lock_guard lock(mutex_);
+  mode_ = mode;
+  aging_ = std::max(aging, std::chrono::steady_clock::duration::zero());
+  ordered_ = mode_ == SchedulingMode::Deadline || aging_.count() > 0;
+  for (Entry& entry : pq_) {
+    updateKey(entry);
+  }
+  std::make_heap(pq_.begin(), pq_.end(), Comparer());
+}
+
+SchedulingMode DispatchQueue::schedulingMode() const { return mode_; }
+
+void DispatchQueue::setThreadConfig(ThreadConfig config) {
   {
-    std::lock_guard lock(mutex_);
-    exit_ = false;
-    workers_ = std::vector<Worker>(size);
-    for (Worker& w : workers_) {
-      if (!w.thread.native_handle()) {
-        w.thread = std::jthread(&DispatchQueue::workerThread, this, &w);
-      }
+    std::lock_guard lock(config_mutex_);
+    config_ = std::move(config);
+  }
+  g_thread_config_epoch++;
+}
+
+ThreadConfig DispatchQueue::threadConfig() const {
+  std::lock_guard lock(config_mutex_);
+  return config_;
+}
+
+void DispatchQueue::configure(Worker* w) {
+  w->configured = g_thread_config_epoch;
+  const ThreadConfig config = threadConfig();
+
+  const std::string name = config.name.empty() ? name_ : config.name;
+  setCurrentThreadName(name);
+  profiler::setThreadName(name);
+
+  uint64_t mask = config.affinity;
+  const int render_core = g_render_core;
+  if (config.avoid_render_core && render_core >= 0) {
+    if (!mask) {
+      const int cpus = std::min(64, (int)std::thread::hardware_concurrency());
+      mask = cpus < 64 ? ((uint64_t)1 << cpus) - 1 : UINT64_MAX;
+    }
+    // Unless that leaves no core at all.
+    const uint64_t others = mask & ~((uint64_t)1 << render_core);
+    mask = others ? others : mask;
+  }
+  setCurrentThreadAffinity(mask);
+  setCurrentThreadPriority(config.priority);
+}
+
+uint64_t DispatchQueue::missedDeadlineCount() const {
+  return missed_deadlines_;
+}
+
+DispatchQueueStats DispatchQueue::stats() const {
+  DispatchQueueStats stats{};
+  stats.queued = std::max(0, queued_tasks_.load());
+  stats.threads = thread_count_;
+
+  const auto now = std::chrono::steady_clock::now();
+  const auto epoch = std::chrono::steady_clock::time_point(
+      std::chrono::steady_clock::duration(stats_epoch_.load()));
+  int64_t thread_time = retired_time_;
+  {
+    std::shared_lock lock(workers_mutex_);
+    stats.latency = retired_latency_;
+    stats.run_time = retired_run_time_;
+    stats.depth = retired_depth_;
+    stats.completed = retired_completed_;
+    stats.cancelled = cancelled_;
+    for (const std::unique_ptr<Worker>& w : workers_) {
+      stats.latency.merge(w->stats.latency.snapshot());
+      stats.run_time.merge(w->stats.run_time.snapshot());
+      stats.depth.merge(w->stats.depth.snapshot());
+      stats.completed += w->stats.completed.load(std::memory_order_relaxed);
+      stats.cancelled += w->stats.cancelled.load(std::memory_order_relaxed);
+      stats.running += w->stats.running.load(std::memory_order_relaxed);
+      thread_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now - std::max(epoch, w->started))
+                         .count();
     }
   }
+  stats.utilization =
+      thread_time > 0
+          ? std::min(1.0, (double)stats.run_time.sum / (double)thread_time)
+          : 0.0;
+  return stats;
+}
+
+void DispatchQueue::resetStats() {
+  std::unique_lock lock(workers_mutex_);
+  for (const std::unique_ptr<Worker>& w : workers_) {
+    w->stats.latency.reset();
+    w->stats.run_time.reset();
+    w->stats.depth.reset();
+    w->stats.completed.store(0, std::memory_order_relaxed);
+    w->stats.cancelled.store(0, std::memory_order_relaxed);
+  }
+  retired_latency_ = {};
+  retired_run_time_ = {};
+  retired_depth_ = {};
+  retired_completed_ = 0;
+  cancelled_ = 0;
+  retired_time_ = 0;
+  stats_epoch_ = std::chrono::steady_clock::now().time_since_epoch().count();
 }
 
-int DispatchQueue::waitingTaskCount() const { return (int)pq_.size() + running_threads_; }
+const char* DispatchQueue::name() const { return name_; }
+
+int DispatchQueue::threadCount() const { return thread_count_; }
+
+int DispatchQueue::waitingTaskCount() const {
+  int running = 0;
+  {
+    std::shared_lock lock(workers_mutex_);
+    for (const std::unique_ptr<Worker>& w : workers_) {
+      running += w->stats.running.load(std::memory_order_relaxed);
+    }
+  }
+  return std::max(0, queued_tasks_.load()) + running;
+}
 
 void DispatchQueue::workerThread(Worker* w) {
-  task::Task task;
+  current_worker_ = w;
+  current_queue_ = this;
+
+  Entry entry;
   while (!exit_) {
-    {
+    if (thread_count_ > max_threads_ && retire(w, false)) {
+      break;
+    }
+
+    if (!pop(w, entry)) {
       std::unique_lock lock(mutex_);
-      cv_.wait(lock, [&] { return exit_ || !pq_.empty(); });
-      if (exit_) {
+      sleeping_threads_++;
+      const bool woken = cv_.wait_for(lock,
+          std::chrono::steady_clock::duration(idle_timeout_.load()), [&] {
+            return exit_ || queued_tasks_ > 0 ||
+                   thread_count_ > max_threads_;
+          });
+      sleeping_threads_--;
+      lock.unlock();
+      if (!woken && retire(w, true)) {
         break;
       }
-      task = pq_.top();
-      pq_.pop();
+      continue;
     }
-    cv_.notify_all();
+    w->stats.depth.add(std::max(0, queued_tasks_--));
+
+    if (w->configured != g_thread_config_epoch) {
+      configure(w);
+    }
+    run(w, entry);
+    entry = {};
+
+    finish(1);
+  }
+
+  current_worker_ = nullptr;
+  current_queue_ = nullptr;
+
+  // The destructor waits for this, nothing touches the queue after.
+  std::lock_guard lock(mutex_);
+  live_threads_--;
+  cv_idle_.notify_all();
+}
+
+void DispatchQueue::run(Worker* w, Entry& entry) {
+  Task& task = entry.task;
+  w->cancel = false;
 
-    w->cancel = false;
-    running_threads_++;
+  const auto start = std::chrono::steady_clock::now();
+  w->stats.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      start - entry.enqueued)
+                           .count());
+
+  // Tasks are waiting too long, more hands are needed.
+  if (start - entry.enqueued >
+          std::chrono::steady_clock::duration(scale_latency_.load()) &&
+      queued_tasks_ > 0 && thread_count_ < max_threads_) {
+    spawn();
+  }
+
+  const auto call = [&] {
+    PROFILE_ZONE(name_, "task");
+    w->stats.running.store(true, std::memory_order_relaxed);
     task.func(w->cancel);
-    running_threads_--;
+    w->stats.running.store(false, std::memory_order_relaxed);
+    const auto end = std::chrono::steady_clock::now();
+    w->stats.run_time.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+    w->stats.completed++;
+    if (task.deadline != kNoDeadline && end > task.deadline) {
+      missed_deadlines_++;
+    }
+  };
+
+  if (!task.token) {
+    call();
+    return;
+  }
+
+  CancellationToken::State* token = task.token->state_.get();
+  {
+    std::lock_guard lock(token->mutex);
+    if (token->cancelled) {
+      w->stats.cancelled++;
+      return;
+    }
+    token->running.push_back(&w->cancel);
+  }
+
+  call();
+
+  {
+    std::lock_guard lock(token->mutex);
+    std::erase(token->running, &w->cancel);
+  }
+}
+
+bool DispatchQueue::pop(Worker* w, Entry& entry) {
+  if (popPriority(entry, true)) {
+    return true;
+  }
+
+  {
+    std::lock_guard lock(w->mutex);
+    if (!w->tasks.empty()) {
+      entry = std::move(w->tasks.front());
+      w->tasks.pop_front();
+      return true;
+    }
+  }
+
+  MPMCQueue<Entry>* ring = ring_.load(std::memory_order_acquire);
+  if (ring && ring->try_pop(entry)) {
+    return true;
+  }
+
+  if (steal(w, entry, false) || popPriority(entry, false)) {
+    return true;
+  }
+
+  // Someone still holds a task we skipped over with try_lock.
+  return queued_tasks_ > 0 && steal(w, entry, true);
+}
+
+bool DispatchQueue::popPriority(Entry& entry, bool urgent_only) {
+  if (priority_tasks_ <= 0) {
+    return false;
+  }
+
+  std::lock_guard lock(mutex_);
+  if (pq_.empty() ||
+      (urgent_only && !ordered_ && pq_.front().task.priority >= 0)) {
+    return false;
+  }
+  std::pop_heap(pq_.begin(), pq_.end(), Comparer());
+  entry = std::move(pq_.back());
+  pq_.pop_back();
+  priority_tasks_--;
+  return true;
+}
+
+void DispatchQueue::pushPriority(Entry&& entry) {
+  std::lock_guard lock(mutex_);
+  entry.seq = seq_++;
+  updateKey(entry);
+  pq_.push_back(std::move(entry));
+  std::push_heap(pq_.begin(), pq_.end(), Comparer());
+  priority_tasks_++;
+}
+
+bool DispatchQueue::useLane(const Task& task) const {
+  return task.priority != 0 || ordered_;
+}
+
+void DispatchQueue::updateKey(Entry& entry) const {
+  int64_t priority = entry.task.priority;
+  if (aging_.count() > 0) {
+    // Order by the time at which the task ages to priority 0.
+    priority = entry.enqueued.time_since_epoch().count() +
+               entry.task.priority * aging_.count();
+  }
+
+  if (mode_ == SchedulingMode::Deadline) {
+    entry.key = entry.task.deadline.time_since_epoch().count();
+    entry.subkey = priority;
+  } else {
+    entry.key = priority;
+    entry.subkey = 0;
+  }
+}
+
+bool DispatchQueue::steal(Worker* w, Entry& entry, bool blocking) {
+  std::shared_lock workers_lock(workers_mutex_);
+  const size_t count = workers_.size();
+  for (size_t i = 1; i < count; ++i) {
+    Worker* victim = workers_[(w->index + i) % count].get();
+    std::unique_lock lock(victim->mutex, std::defer_lock);
+    if (blocking) {
+      lock.lock();
+    } else if (!lock.try_lock()) {
+      continue;
+    }
+    if (!victim->tasks.empty()) {
+      entry = std::move(victim->tasks.back());
+      victim->tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void DispatchQueue::wake(int count) {
+  const int sleeping = sleeping_threads_;
+  if (sleeping > 0) {
+    // Serialize with a worker which is about to sleep.
+    { std::lock_guard lock(mutex_); }
+    if (count >= sleeping) {
+      cv_.notify_all();
+    } else {
+      for (int i = 0; i < count; ++i) {
+        cv_.notify_one();
+      }
+    }
+  }
+}
+
+void DispatchQueue::finish(int count) {
+  if (count > 0 && (pending_tasks_ -= count) <= 0) {
+    { std::lock_guard lock(mutex_); }
+    cv_idle_.notify_all();
+  }
+}
+
+bool DispatchQueue::spawn() {
+  std::unique_lock lock(workers_mutex_);
+  if (exit_ || thread_count_ >= max_threads_) {
+    return false;
+  }
+
+  auto w = std::make_unique<Worker>();
+  w->index = (int)workers_.size();
+  w->started = std::chrono::steady_clock::now();
+  live_threads_++;
+  w->thread = std::jthread(&DispatchQueue::workerThread, this, w.get());
+  workers_.push_back(std::move(w));
+  thread_count_++;
+  return true;
+}
+
+bool DispatchQueue::retire(Worker* w, bool idle) {
+  // Idle workers shrink the pool down to the minimum, busy ones only down to
+  // the maximum.
+  const int floor = idle ? min_threads_ : max_threads_;
+  int threads = thread_count_;
+  do {
+    if (exit_ || threads <= floor) {
+      return false;
+    }
+  } while (!thread_count_.compare_exchange_weak(threads, threads - 1));
+
+  // Nobody joins a retired worker, which could deadlock two retiring at once
+  // or block an enqueue() which spawns. The thread detaches and is waited for
+  // by the destructor.
+  std::unique_ptr<Worker> retired;
+  std::deque<Entry> orphaned;
+  {
+    std::unique_lock lock(workers_mutex_);
+    auto it = std::find_if(workers_.begin(), workers_.end(),
+        [w](const std::unique_ptr<Worker>& p) { return p.get() == w; });
+    if (it != workers_.end()) {
+      {
+        std::lock_guard worker_lock(w->mutex);
+        orphaned.swap(w->tasks);
+      }
+      const auto epoch = std::chrono::steady_clock::time_point(
+          std::chrono::steady_clock::duration(stats_epoch_.load()));
+      retired_time_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - std::max(epoch, w->started))
+                           .count();
+      retired_latency_.merge(w->stats.latency.snapshot());
+      retired_run_time_.merge(w->stats.run_time.snapshot());
+      retired_depth_.merge(w->stats.depth.snapshot());
+      retired_completed_ += w->stats.completed;
+      cancelled_ += w->stats.cancelled;
+      retired = std::move(*it);
+      retired->thread.detach();
+      workers_.erase(it);
+      current_worker_ = nullptr;
+      current_queue_ = nullptr;
+      for (int i = 0; i < (int)workers_.size(); ++i) {
+        workers_[i]->index = i;
+      }
+    }
+  }
+
+  // Hand the leftovers to the lane where the remaining workers find them.
+  for (Entry& entry : orphaned) {
+    pushPriority(std::move(entry));
+  }
+  if (!orphaned.empty()) {
     cv_.notify_all();
   }
+  // A task may have been handed to us after the last worker was counted out.
+  scale();
+  return true;
+}
+
+void DispatchQueue::scale() {
+  const int threads = thread_count_;
+  if (threads >= max_threads_) {
+    return;
+  }
+  if (threads < min_threads_ ||
+      queued_tasks_ > (int64_t)scale_depth_ * threads) {
+    // A bulk enqueue may call for several workers at once.
+    if (spawn()) {
+      scale();
+    }
+  }
+}
+
+TimerWheel::TimerWheel()
+    : origin_(std::chrono::steady_clock::now()),
+      current_(0),
+      wakeup_(UINT64_MAX),
+      size_(0),
+      exit_(false) {
+  thread_ = std::jthread(&TimerWheel::timerThread, this);
+}
+
+TimerWheel::~TimerWheel() {
+  {
+    std::lock_guard lock(mutex_);
+    exit_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TimerWheel::schedule(DispatchQueue* queue,
+    std::chrono::steady_clock::duration delay,
+    std::chrono::steady_clock::duration period, Task&& task) {
+  const auto now = std::chrono::steady_clock::now();
+  const auto tick = std::chrono::milliseconds(1);
+  // Rounded up, timers never fire early.
+  Node node{toTick(now + delay + tick - std::chrono::nanoseconds(1)),
+      (uint64_t)std::max<int64_t>(
+          0, std::chrono::ceil<std::chrono::milliseconds>(period).count()),
+      queue, std::move(task)};
+
+  bool notify = false;
+  {
+    std::lock_guard lock(mutex_);
+    if (size_ == 0) {
+      // Nothing to expire, skip the ticks spent idle.
+      current_ = std::max(current_, toTick(now));
+    }
+    notify = node.expires < wakeup_;
+    insert(std::move(node));
+    size_++;
+  }
+  if (notify) {
+    cv_.notify_one();
+  }
+}
+
+int TimerWheel::size() const { return size_; }
+
+void TimerWheel::timerThread() {
+  std::vector<Node> expired;
+  std::vector<Node> dropped;
+  std::unique_lock lock(mutex_);
+  while (!exit_) {
+    const uint64_t now = toTick(std::chrono::steady_clock::now());
+    while (current_ <= now) {
+      advance(expired, dropped);
+    }
+
+    if (!expired.empty() || !dropped.empty()) {
+      // Enqueue outside of the lock, tasks may schedule timers themselves.
+      // Destroying a dropped task cancels its future, whose continuations
+      // run right here and may do the same.
+      lock.unlock();
+      for (Node& node : expired) {
+        node.queue->enqueue(std::move(node.task));
+      }
+      expired.clear();
+      dropped.clear();
+      lock.lock();
+      continue;
+    }
+
+    if (size_ == 0) {
+      wakeup_ = UINT64_MAX;
+      cv_.wait(lock);
+    } else {
+      wakeup_ = nextTick();
+      cv_.wait_until(
+          lock, origin_ + std::chrono::milliseconds(wakeup_));
+    }
+    wakeup_ = 0;
+  }
+}
+
+void TimerWheel::insert(Node&& node) {
+  node.expires = std::max(node.expires, current_);
+  const uint64_t delta = node.expires - current_;
+  int level = 0;
+  while (level < kLevels - 1 &&
+         delta >= (uint64_t)1 << (kSlotBits * (level + 1))) {
+    level++;
+  }
+  // Beyond the wheel's range, the timer is reinserted on each turn of the
+  // top level until it is in range.
+  const uint64_t limit = current_ + ((uint64_t)1 << (kSlotBits * kLevels)) - 1;
+  const uint64_t expires = std::min(node.expires, limit);
+  const int slot = (int)((expires >> (kSlotBits * level)) & (kSlots - 1));
+  slots_[level][slot].push_back(std::move(node));
+}
+
+void TimerWheel::advance(
+    std::vector<Node>& expired, std::vector<Node>& dropped) {
+  // Entering a new turn of a level moves the matching slot one level down.
+  for (int level = 1; level < kLevels; ++level) {
+    if ((current_ & (((uint64_t)1 << (kSlotBits * level)) - 1)) != 0) {
+      break;
+    }
+    const int slot = (int)((current_ >> (kSlotBits * level)) & (kSlots - 1));
+    std::vector<Node> nodes;
+    nodes.swap(slots_[level][slot]);
+    for (Node& node : nodes) {
+      insert(std::move(node));
+    }
+  }
+
+  std::vector<Node> nodes;
+  nodes.swap(slots_[0][current_ & (kSlots - 1)]);
+  current_++;
+  for (Node& node : nodes) {
+    if (node.task.token && node.task.token->cancelled()) {
+      size_--;
+      dropped.push_back(std::move(node));
+      continue;
+    }
+    if (node.period == 0) {
+      size_--;
+      expired.push_back(std::move(node));
+      continue;
+    }
+    expired.push_back({node.expires, 0, node.queue, node.task});
+    node.expires += node.period;
+    insert(std::move(node));
+  }
+}
+
+uint64_t TimerWheel::nextTick() const {
+  // The next occupied slot of the lowest level, or the next cascade.
+  const uint64_t turn = (current_ | (kSlots - 1)) + 1;
+  for (uint64_t tick = current_; tick < turn; ++tick) {
+    if (!slots_[0][tick & (kSlots - 1)].empty()) {
+      return tick;
+    }
+  }
+  return turn;
+}
+
+uint64_t TimerWheel::toTick(std::chrono::steady_clock::time_point time) const {
+  return (uint64_t)std::max<int64_t>(0,
+      std::chrono::duration_cast<std::chrono::milliseconds>(time - origin_)
+          .count());
+}
+
+TimerWheel* timerWheel() {
+  static TimerWheel wheel;
+  return &wheel;
 }
 
 DispatchQueue* dispatchQueue() {
-  return &g_dispatch_queue_map[kDefaultDispatchQueueId];
+  return dispatchQueue(kDefaultDispatchQueueId);
+}
+
+DispatchQueue* dispatchQueue(std::string_view id) {
+  return g_dispatch_queue_registry.get(id);
+}
+
+void MainAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  auto resumption = std::make_shared<detail::Resumption>(handle);
+  dispatchMain([resumption]() { resumption->resume(); });
+}
+
+void setMainDispatcher(main_dispatcher_t dispatcher) {
+  std::lock_guard lock(g_main_dispatcher_mutex);
+  g_main_dispatcher = std::move(dispatcher);
+}
+
+void dispatchMain(std::function<void()> func) {
+  main_dispatcher_t dispatcher;
+  {
+    std::lock_guard lock(g_main_dispatcher_mutex);
+    dispatcher = g_main_dispatcher;
+  }
+  if (dispatcher) {
+    dispatcher(std::move(func));
+  } else {
+    func();
+  }
+}
+
+DispatchQueue* parallelQueue() {
+  static DispatchQueue* queue = [] {
+    DispatchQueue* queue = dispatchQueue(kParallelDispatchQueueId);
+    ThreadConfig config;
+    config.avoid_render_core = true;
+    queue->setThreadConfig(config);
+    queue->setThreadCount(
+        std::max(1, (int)std::thread::hardware_concurrency() - 1));
+    return queue;
+  }();
+  return queue;
+}
+
+struct ParallelJob {
+  size_t begin;
+  size_t end;
+  size_t step;
+  size_t chunks;
+  const std::function<void(size_t, size_t)>* func;
+  std::atomic<size_t> next;
+  std::atomic<size_t> done;
+  std::mutex mutex;
+  std::exception_ptr exception;
+
+  // Claims and runs chunks until none are left.
+  void run() {
+    size_t i;
+    while ((i = next++) < chunks) {
+      const size_t b = begin + i * step;
+      try {
+        (*func)(b, std::min(end, b + step));
+      } catch (...) {
+        std::lock_guard lock(mutex);
+        if (!exception) {
+          exception = std::current_exception();
+        }
+      }
+      if (++done == chunks) {
+        done.notify_all();
+      }
+    }
+  }
+};
+
+size_t parallel_chunk_size(size_t begin, size_t end, size_t grain) {
+  if (grain > 0) {
+    return grain;
+  }
+  // A few chunks per thread to even out uneven rows.
+  const size_t count = end > begin ? end - begin : 0;
+  const size_t threads = parallelQueue()->threadCount() + 1;
+  return std::max<size_t>(1, count / (threads * 4));
 }
 
-DispatchQueue* dispatchQueue(const char* id) {
-  return &g_dispatch_queue_map[id];
+void parallel_for(size_t begin, size_t end,
+    const std::function<void(size_t, size_t)>& func, size_t grain) {
+  if (end <= begin) {
+    return;
+  }
+  const size_t step = parallel_chunk_size(begin, end, grain);
+  const size_t chunks = (end - begin + step - 1) / step;
+  if (chunks == 1) {
+    func(begin, end);
+    return;
+  }
+
+  // Helpers may start after the job is done, so they share ownership.
+  auto job = std::make_shared<ParallelJob>();
+  job->begin = begin;
+  job->end = end;
+  job->step = step;
+  job->chunks = chunks;
+  job->func = &func;
+  job->next = 0;
+  job->done = 0;
+
+  DispatchQueue* queue = parallelQueue();
+  const size_t helpers =
+      std::min<size_t>(queue->threadCount(), job->chunks - 1);
+  for (size_t i = 0; i < helpers; ++i) {
+    Task task{};
+    task.priority = -1;
+    task.func = [job](std::atomic<bool>&) { job->run(); };
+    queue->enqueue(std::move(task));
+  }
+
+  job->run();
+  for (size_t done = job->done; done < job->chunks; done = job->done) {
+    job->done.wait(done);
+  }
+
+  if (job->exception) {
+    std::rethrow_exception(job->exception);
+  }
 }
 
-void dispatchAsync(const char* id, func_t func, int priority) {
-  dispatchQueue(id)->enqueue({priority, func});
+CancellationToken cancellationGroup(const char* tag) {
+  std::lock_guard lock(g_cancellation_group_mutex);
+  return g_cancellation_group_map[tag];
 }
 
-void dispatchAsync(func_t func) {
-  dispatchAsync(kDefaultDispatchQueueId, func, 0);
+void cancelGroup(const char* tag) {
+  CancellationToken token;
+  {
+    std::lock_guard lock(g_cancellation_group_mutex);
+    auto it = g_cancellation_group_map.find(tag);
+    if (it == g_cancellation_group_map.end()) {
+      return;
+    }
+    std::swap(token, it->second);
+  }
+  token.cancel();
 }
 
 void enumerateDispatchQueues(std::function<void(const char*)> callback) {
-  std::lock_guard lock(g_dispatch_queue_mutex);
-  for (const auto& kv : g_dispatch_queue_map) {
-    callback(kv.first.c_str());
+  if (const auto* table = g_dispatch_queue_registry.snapshot()) {
+    for (DispatchQueue* queue : table->queues) {
+      callback(queue->name());
+    }
+  }
+}
+
+void enumerateDispatchQueues(
+    std::function<void(const char*, const DispatchQueueStats&)> callback) {
+  if (const auto* table = g_dispatch_queue_registry.snapshot()) {
+    for (DispatchQueue* queue : table->queues) {
+      callback(queue->name(), queue->stats());
+    }
   }
 }
 
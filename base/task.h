@@ -1,14 +1,31 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
+#include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string_view>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#include "container.h"
+
 namespace chaos {
 
 struct Timer {
@@ -17,6 +34,7 @@ struct Timer {
   virtual ~Timer();
 
   double elapsed() const;
+  std::chrono::high_resolution_clock::time_point start() const;
 
  private:
   std::string name_;
@@ -25,54 +43,1018 @@ struct Timer {
 
 namespace task {
 
+constexpr const char* kDefaultDispatchQueueId = "global";
+constexpr const char* kParallelDispatchQueueId = "parallel";
+
 using func_t = std::function<void(std::atomic<bool>&)>;
 
+class CancelledError : public std::runtime_error {
+ public:
+  CancelledError() : std::runtime_error("task cancelled.") {}
+};
+
+// Shared cancellation flag, copies refer to the same flag. Cancelling is
+// O(1): queued tasks carrying the token are dropped when they reach a worker,
+// running ones see their |cancel| argument raised.
+class CancellationToken {
+ public:
+  CancellationToken();
+
+  void cancel();
+  bool cancelled() const noexcept;
+
+ private:
+  friend class DispatchQueue;
+
+  struct State {
+    std::atomic<bool> cancelled;
+    std::mutex mutex;
+    std::vector<std::atomic<bool>*> running;
+  };
+  std::shared_ptr<State> state_;
+};
+
+using deadline_t = std::chrono::steady_clock::time_point;
+constexpr deadline_t kNoDeadline = deadline_t::max();
+
 struct Task {
   int priority;
   func_t func;
+  std::optional<CancellationToken> token;
+  deadline_t deadline = kNoDeadline;
+};
+
+enum class ThreadPriority {
+  // Prefers efficiency cores on hybrid CPUs where the OS supports it.
+  Background,
+  Low,
+  Normal,
+  High,
+};
+
+struct ThreadConfig {
+  // Worker thread name, the queue id when empty.
+  std::string name;
+  // CPUs the workers may run on, bit i is CPU i, within those the process
+  // may use. 0 restores the process affinity.
+  uint64_t affinity = 0;
+  ThreadPriority priority = ThreadPriority::Normal;
+  // Keeps the workers off the core reserved by setRenderCore().
+  bool avoid_render_core = false;
+};
+
+// Apply to the calling thread. False when the OS refused, e.g. raising the
+// priority without the privilege to.
+bool setCurrentThreadName(const std::string& name);
+bool setCurrentThreadAffinity(uint64_t mask);
+bool setCurrentThreadPriority(ThreadPriority priority);
+
+// Pins the calling thread, the render loop, to |core| and keeps workers of
+// queues with ThreadConfig::avoid_render_core off it. -1 releases the core.
+void setRenderCore(int core);
+int renderCore();
+
+enum class SchedulingMode {
+  // Lower priority first, FIFO within a priority.
+  Priority,
+  // Earliest deadline first, then as Priority. Tasks without a deadline run
+  // last.
+  Deadline,
 };
 
+// Log2-bucketed histogram, bucket i counts values in [2^(i-1), 2^i).
+struct Histogram {
+  static constexpr int kBuckets = 48;
+
+  std::array<uint64_t, kBuckets> buckets{};
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  double mean() const;
+  // Upper bound of the bucket holding the |p| quantile, |p| in [0, 1].
+  uint64_t percentile(double p) const;
+  // Adds the counts of |other|.
+  void merge(const Histogram& other);
+};
+
+namespace detail {
+
+// Histogram recorded with relaxed atomics, cheap enough to leave on.
+class AtomicHistogram {
+ public:
+  void add(uint64_t value);
+  Histogram snapshot() const;
+  void reset();
+
+ private:
+  std::array<std::atomic<uint64_t>, Histogram::kBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+}  // namespace detail
+
+// Scheduling telemetry of a DispatchQueue since its last resetStats().
+// Durations are in nanoseconds.
+struct DispatchQueueStats {
+  // From enqueue to start.
+  Histogram latency;
+  Histogram run_time;
+  // Queued tasks, sampled as each task starts.
+  Histogram depth;
+  uint64_t completed;
+  // Dropped by cancel() or by their token before they started.
+  uint64_t cancelled;
+  int queued;
+  int running;
+  int threads;
+  // Share of the workers' lifetime spent running tasks.
+  double utilization;
+};
+
+// Work-stealing task queue. Each worker owns a deque which it drains from the
+// front, idle workers steal from the back of the others. Tasks with a
+// non-default priority go through a shared priority lane; negative priorities
+// run ahead of the deques, positive ones once the deques are empty. Deadline
+// scheduling and priority aging need a global order, so with either enabled
+// every task goes through the lane.
+//
+// The pool is elastic: it grows up to the maximum thread count while tasks
+// queue up and retires workers which stay idle, without draining in-flight
+// work.
 class DispatchQueue {
  public:
-  DispatchQueue();
+  explicit DispatchQueue(const char* name = "");
   ~DispatchQueue();
 
   void cancel();
   void wait();
   void enqueue(Task&& task);
+  // Enqueues all of |tasks|, moving from them, with one pass over the locks
+  // and one wake-up per task up to the number of sleeping workers.
+  void enqueueBulk(std::span<Task> tasks);
+  // Lock-free unless a worker has to be woken. Falls back to enqueue() when
+  // the submission ring is off or full and for prioritized tasks.
+  void submit(Task&& task);
+  // Creates the submission ring used by submit(). Only the first call has an
+  // effect.
+  void setSubmissionRing(size_t capacity);
   void setThreadCount(int size);
+  int threadCount() const;
   int waitingTaskCount() const;
 
+  // Keeps between |min_threads| and |max_threads| workers. Workers above
+  // |min_threads| retire after |idle_timeout| without work.
+  void setThreadRange(int min_threads, int max_threads,
+      std::chrono::steady_clock::duration idle_timeout =
+          std::chrono::seconds(5));
+
+  // A worker is added when more than |depth| tasks per worker are waiting, or
+  // when a task waited longer than |latency| before it started.
+  void setScaleThreshold(
+      int depth, std::chrono::steady_clock::duration latency);
+
+  // Applied by running workers before their next task.
+  void setThreadConfig(ThreadConfig config);
+  ThreadConfig threadConfig() const;
+
+  // |aging| > 0 promotes a waiting task by one priority level per |aging|, so
+  // old low-priority tasks cannot starve.
+  void setSchedulingMode(SchedulingMode mode,
+      std::chrono::steady_clock::duration aging = {});
+  SchedulingMode schedulingMode() const;
+
+  // Tasks which finished after their deadline.
+  uint64_t missedDeadlineCount() const;
+
+  // The id the queue is registered under.
+  const char* name() const;
+
+  DispatchQueueStats stats() const;
+  void resetStats();
+
  private:
+  struct Entry {
+    int64_t key;
+    int64_t subkey;
+    uint64_t seq;
+    std::chrono::steady_clock::time_point enqueued;
+    Task task;
+  };
   struct Worker {
     Worker();
     ~Worker();
     std::jthread thread;
     std::atomic<bool> cancel;
+    int index;
+    std::chrono::steady_clock::time_point started;
+    // Thread config epoch the thread was last configured for.
+    uint64_t configured;
+
+    std::mutex mutex;
+    std::deque<Entry> tasks;
+
+    // Telemetry, written by the worker alone and merged by stats(), so
+    // workers do not contend on shared counters for every task.
+    struct alignas(64) Stats {
+      detail::AtomicHistogram latency;
+      detail::AtomicHistogram run_time;
+      detail::AtomicHistogram depth;
+      std::atomic<uint64_t> completed{0};
+      std::atomic<uint64_t> cancelled{0};
+      std::atomic<bool> running{false};
+    } stats;
   };
   void workerThread(Worker* w);
+  void run(Worker* w, Entry& entry);
+  void updateKey(Entry& entry) const;
+  bool useLane(const Task& task) const;
+  bool pop(Worker* w, Entry& entry);
+  bool popPriority(Entry& entry, bool urgent_only);
+  bool steal(Worker* w, Entry& entry, bool blocking);
+  void pushPriority(Entry&& entry);
+  void configure(Worker* w);
+  void wake(int count = 1);
+  void finish(int count);
+  bool spawn();
+  bool retire(Worker* w, bool idle);
+  void scale();
 
-  std::vector<Worker> workers_;
+  // Guards the worker list. Workers are added and retired while others
+  // steal from it.
+  mutable std::shared_mutex workers_mutex_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  const char* name_;
 
+  static thread_local Worker* current_worker_;
+  static thread_local DispatchQueue* current_queue_;
+
+  // Min-heap on (key, subkey, seq), see updateKey().
   struct Comparer {
-    bool operator()(const Task& a, const Task& b) {
-      return a.priority > b.priority;
+    bool operator()(const Entry& a, const Entry& b) const {
+      if (a.key != b.key) return a.key > b.key;
+      if (a.subkey != b.subkey) return a.subkey > b.subkey;
+      return a.seq > b.seq;
     }
   };
-  std::priority_queue<Task, std::vector<Task>, Comparer> pq_;
+  std::vector<Entry> pq_;
+  std::atomic<MPMCQueue<Entry>*> ring_;
+  uint64_t seq_;
+  // Written under |mutex_|, atomic for schedulingMode().
+  std::atomic<SchedulingMode> mode_;
+  std::chrono::steady_clock::duration aging_;
+  std::atomic<bool> ordered_;
+  std::atomic<uint64_t> missed_deadlines_;
+
+  // Telemetry of retired workers, guarded by |workers_mutex_|.
+  Histogram retired_latency_;
+  Histogram retired_run_time_;
+  Histogram retired_depth_;
+  uint64_t retired_completed_;
+  // Dropped by cancel() and counted by retired workers.
+  std::atomic<uint64_t> cancelled_;
+  // Lifetime of retired workers since |stats_epoch_|, in nanoseconds.
+  std::atomic<int64_t> retired_time_;
+  std::atomic<int64_t> stats_epoch_;
+
+  mutable std::mutex config_mutex_;
+  ThreadConfig config_;
+
+  std::atomic<int> thread_count_;
+  std::atomic<int> min_threads_;
+  std::atomic<int> max_threads_;
+  std::atomic<int> scale_depth_;
+  std::atomic<int64_t> scale_latency_;
+  std::atomic<int64_t> idle_timeout_;
 
   std::mutex mutex_;
   std::condition_variable cv_;
+  std::condition_variable cv_idle_;
   std::atomic<bool> exit_;
-  std::atomic<int> running_threads_;
+  std::atomic<int> queued_tasks_;
+  std::atomic<int> pending_tasks_;
+  std::atomic<int> priority_tasks_;
+  std::atomic<int> sleeping_threads_;
+  std::atomic<unsigned int> next_worker_;
+  // Worker threads not yet exited, retired ones detach themselves. Drops
+  // under |mutex_|.
+  std::atomic<int> live_threads_;
 };
 
+// Queues are created on first use and live until exit. Looking one up is
+// wait-free and does not allocate, creating one takes a lock.
 DispatchQueue* dispatchQueue();
-DispatchQueue* dispatchQueue(const char* id);
+DispatchQueue* dispatchQueue(std::string_view id);
+
+// A dispatch queue given by id or by handle. Keep the DispatchQueue* of hot
+// queues around to skip the lookup.
+class QueueRef {
+ public:
+  QueueRef(const char* id) : queue_(dispatchQueue(id)) {}
+  QueueRef(DispatchQueue* queue) : queue_(queue) {}
+
+  DispatchQueue* get() const { return queue_; }
+
+ private:
+  DispatchQueue* queue_;
+};
+
+// Hierarchical timer wheel. Four levels of 256 slots at 1 ms resolution cover
+// ~49 days, timers cascade down a level as their slot comes up. Scheduling
+// and expiry are O(1). A single thread advances the wheel and hands expired
+// tasks to their dispatch queue. A timer whose token is cancelled is dropped
+// when it comes up. Its task is destroyed on the timer thread after the
+// wheel's lock is released, so a future waiting on it is cancelled there and
+// continuations may schedule timers again.
+class TimerWheel {
+ public:
+  TimerWheel();
+  ~TimerWheel();
+
+  // Enqueues |task| on |queue| after |delay|, then every |period| if it is
+  // non-zero.
+  void schedule(DispatchQueue* queue,
+      std::chrono::steady_clock::duration delay,
+      std::chrono::steady_clock::duration period, Task&& task);
+
+  // Timers waiting to expire.
+  int size() const;
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr int kSlots = 1 << kSlotBits;
+
+  struct Node {
+    uint64_t expires;
+    uint64_t period;
+    DispatchQueue* queue;
+    Task task;
+  };
+  void timerThread();
+  void insert(Node&& node);
+  // Moves due timers to |expired| and cancelled ones to |dropped|.
+  void advance(std::vector<Node>& expired, std::vector<Node>& dropped);
+  uint64_t nextTick() const;
+  uint64_t toTick(std::chrono::steady_clock::time_point time) const;
+
+  const std::chrono::steady_clock::time_point origin_;
+  std::vector<Node> slots_[kLevels][kSlots];
+  // Next tick to expire.
+  uint64_t current_;
+  // Tick the timer thread sleeps until.
+  uint64_t wakeup_;
+  std::atomic<int> size_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  bool exit_;
+  std::jthread thread_;
+};
+
+TimerWheel* timerWheel();
+
+template <typename T>
+class Future;
+template <typename T>
+class Promise;
+
+namespace detail {
+
+enum FutureStatus { kPending = 0, kReady, kFailed, kCancelled };
+
+// Move-only void() callable, continuations may own move-only functors and
+// values. Stands in for C++23's std::move_only_function.
+class UniqueFunction {
+ public:
+  UniqueFunction() = default;
+  template <typename F>
+    requires(!std::is_same_v<std::decay_t<F>, UniqueFunction>)
+  UniqueFunction(F&& func)
+      : impl_(std::make_unique<Impl<std::decay_t<F>>>(std::forward<F>(func))) {}
+
+  void operator()() { impl_->call(); }
+
+ private:
+  struct Base {
+    virtual ~Base() = default;
+    virtual void call() = 0;
+  };
+  template <typename F>
+  struct Impl : Base {
+    template <typename U>
+    explicit Impl(U&& func) : func(std::forward<U>(func)) {}
+    void call() override { func(); }
+    F func;
+  };
+
+  std::unique_ptr<Base> impl_;
+};
+
+// Task::func is a std::function, which needs a copyable target. Move-only
+// functors are kept behind a shared_ptr instead.
+template <typename F>
+auto shareable(F&& func) {
+  using D = std::decay_t<F>;
+  if constexpr (std::is_copy_constructible_v<D>) {
+    return D(std::forward<F>(func));
+  } else {
+    return [shared = std::make_shared<D>(std::forward<F>(func))](
+               auto&&... args) -> decltype(auto) {
+      return (*shared)(std::forward<decltype(args)>(args)...);
+    };
+  }
+}
+
+template <typename T>
+struct FutureState {
+  using value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+  std::mutex mutex;
+  std::atomic<int> status{kPending};
+  std::optional<value_t> value;
+  std::exception_ptr exception;
+  std::vector<UniqueFunction> continuations;
+
+  bool complete(int result, std::optional<value_t>&& v = {},
+      std::exception_ptr ex = nullptr) {
+    std::vector<UniqueFunction> callbacks;
+    {
+      std::lock_guard lock(mutex);
+      if (status != kPending) {
+        return false;
+      }
+      value = std::move(v);
+      exception = ex;
+      status = result;
+      callbacks.swap(continuations);
+    }
+    status.notify_all();
+    for (UniqueFunction& callback : callbacks) {
+      callback();
+    }
+    return true;
+  }
+
+  // Runs |callback| once the state is completed, immediately if it already is.
+  void subscribe(UniqueFunction callback) {
+    {
+      std::lock_guard lock(mutex);
+      if (status == kPending) {
+        continuations.push_back(std::move(callback));
+        return;
+      }
+    }
+    callback();
+  }
+};
+
+template <typename R, typename F, typename... Args>
+void fulfill(Promise<R>& promise, F& func, Args&&... args) {
+  try {
+    if constexpr (std::is_void_v<R>) {
+      func(std::forward<Args>(args)...);
+      promise.setValue();
+    } else {
+      promise.setValue(func(std::forward<Args>(args)...));
+    }
+  } catch (...) {
+    promise.setException(std::current_exception());
+  }
+}
+
+template <typename T>
+struct CoroutinePromise;
+
+template <typename T, bool kMove>
+struct FutureAwaiter;
+
+// Consuming continuations take the value as T&&, the others as const T&.
+template <typename T, typename F, bool kMove>
+struct continuation_result {
+  using type = std::invoke_result_t<F&, std::atomic<bool>&,
+      std::conditional_t<kMove, T&&, const T&>>;
+};
+
+template <typename F, bool kMove>
+struct continuation_result<void, F, kMove> {
+  using type = std::invoke_result_t<F&, std::atomic<bool>&>;
+};
+
+}  // namespace detail
+
+// Write side of a Future. A promise destroyed without a result (e.g. its task
+// was dropped by DispatchQueue::cancel()) completes the future as cancelled.
+template <typename T>
+class Promise {
+ public:
+  Promise() : state_(std::make_shared<detail::FutureState<T>>()) {}
+  ~Promise() { cancel(); }
+
+  Promise(const Promise&) = delete;
+  Promise& operator=(const Promise&) = delete;
+
+  Future<T> future() const { return Future<T>(state_); }
+
+  template <typename U = T>
+    requires(!std::is_void_v<U>)
+  void setValue(U value) {
+    state_->complete(detail::kReady, std::move(value));
+  }
+  void setValue()
+    requires std::is_void_v<T>
+  {
+    state_->complete(detail::kReady, std::monostate());
+  }
+  void setException(std::exception_ptr ex) {
+    state_->complete(detail::kFailed, {}, ex);
+  }
+  void cancel() { state_->complete(detail::kCancelled); }
+
+ private:
+  std::shared_ptr<detail::FutureState<T>> state_;
+};
+
+// Lightweight handle on the result of a dispatched task.
+template <typename T>
+class Future {
+ public:
+  using promise_type = detail::CoroutinePromise<T>;
+
+  Future() = default;
+  explicit Future(std::shared_ptr<detail::FutureState<T>> state)
+      : state_(std::move(state)) {}
+
+  bool valid() const noexcept { return (bool)state_; }
+
+  // Non-blocking, true once the task has finished, failed or was cancelled.
+  bool ready() const noexcept {
+    return state_ && state_->status != detail::kPending;
+  }
+  bool cancelled() const noexcept {
+    return state_ && state_->status == detail::kCancelled;
+  }
+
+  void wait() const {
+    if (state_) {
+      state_->status.wait(detail::kPending);
+    }
+  }
+
+  // Blocks until ready, rethrows the task's exception. The rvalue overload
+  // moves the value out, e.g. std::move(future).get() of a move-only value;
+  // other copies of the future are left with the moved-from value.
+  T get() const& {
+    check();
+    if constexpr (!std::is_void_v<T>) {
+      return *state_->value;
+    }
+  }
+  T get() && {
+    check();
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*state_->value);
+    }
+  }
+
+  // Dispatches |func| on |queue| once this future is ready. |func| takes
+  // (std::atomic<bool>& cancel, const T& value), or only |cancel| for void.
+  // Failure and cancellation propagate without running |func|. Called on an
+  // rvalue, e.g. the future just returned by dispatchAsync(), |func| takes
+  // T&& and may keep the value; other copies of the future are then left
+  // with the moved-from value. |func| may be move-only.
+  template <typename F>
+  auto then(QueueRef queue_ref, F&& func, int priority = 0) const& {
+    return chain<false>(queue_ref, std::forward<F>(func), priority);
+  }
+  template <typename F>
+  auto then(QueueRef queue_ref, F&& func, int priority = 0) && {
+    return chain<true>(queue_ref, std::forward<F>(func), priority);
+  }
+
+  template <typename F>
+  auto then(F&& func) const& {
+    return then(kDefaultDispatchQueueId, std::forward<F>(func));
+  }
+  template <typename F>
+  auto then(F&& func) && {
+    return std::move(*this).then(
+        kDefaultDispatchQueueId, std::forward<F>(func));
+  }
+
+  // co_await resumes the awaiting coroutine on the thread completing this
+  // future and yields get(). Awaiting an rvalue, e.g. co_await
+  // dispatchAsync(...), moves the value out.
+  detail::FutureAwaiter<T, false> operator co_await() const& {
+    return {*this};
+  }
+  detail::FutureAwaiter<T, true> operator co_await() && {
+    return {std::move(*this)};
+  }
+
+ private:
+  template <typename U>
+  friend Future<void> when_all(const std::vector<Future<U>>& futures);
+  template <typename U>
+  friend Future<size_t> when_any(const std::vector<Future<U>>& futures);
+  template <typename U, bool kMove>
+  friend struct detail::FutureAwaiter;
+
+  // Waits, then throws unless the future holds a value.
+  void check() const {
+    if (!state_) {
+      throw std::logic_error("invalid future.");
+    }
+    wait();
+    if (state_->status == detail::kFailed) {
+      std::rethrow_exception(state_->exception);
+    } else if (state_->status == detail::kCancelled) {
+      throw CancelledError();
+    }
+  }
+
+  template <bool kMove, typename F>
+  auto chain(QueueRef queue_ref, F&& func, int priority) const {
+    using R = typename detail::continuation_result<T, std::decay_t<F>,
+        kMove>::type;
+    auto promise = std::make_shared<Promise<R>>();
+    Future<R> future = promise->future();
+    if (!state_) {
+      promise->setException(
+          std::make_exception_ptr(std::logic_error("invalid future.")));
+      return future;
+    }
+
+    DispatchQueue* queue = queue_ref.get();
+    std::shared_ptr<detail::FutureState<T>> state = state_;
+    subscribe([=, func = std::forward<F>(func)]() mutable {
+      if (state->status == detail::kFailed) {
+        promise->setException(state->exception);
+        return;
+      } else if (state->status == detail::kCancelled) {
+        promise->cancel();
+        return;
+      }
+      Task task{};
+      task.priority = priority;
+      task.func = [promise, state, func = detail::shareable(std::move(func))](
+                      std::atomic<bool>& cancel) mutable {
+        if constexpr (std::is_void_v<T>) {
+          detail::fulfill(*promise, func, cancel);
+        } else if constexpr (kMove) {
+          detail::fulfill(*promise, func, cancel, std::move(*state->value));
+        } else {
+          detail::fulfill(*promise, func, cancel, *state->value);
+        }
+      };
+      queue->enqueue(std::move(task));
+    });
+    return future;
+  }
+
+  void subscribe(detail::UniqueFunction callback) const {
+    state_->subscribe(std::move(callback));
+  }
+
+  std::shared_ptr<detail::FutureState<T>> state_;
+};
+
+namespace detail {
+
+template <typename T, bool kMove>
+struct FutureAwaiter {
+  Future<T> future;
+
+  bool await_ready() const noexcept { return future.ready(); }
+  void await_suspend(std::coroutine_handle<> handle) const {
+    future.subscribe([handle]() { handle.resume(); });
+  }
+  T await_resume() {
+    if constexpr (kMove) {
+      return std::move(future).get();
+    } else {
+      return future.get();
+    }
+  }
+};
+
+// Sets |task|'s function to run |func| and returns its future.
+template <typename F>
+auto bind(Task& task, F&& func) {
+  using R = std::invoke_result_t<std::decay_t<F>&, std::atomic<bool>&>;
+  auto promise = std::make_shared<Promise<R>>();
+  Future<R> future = promise->future();
+  task.func = [promise, func = shareable(std::forward<F>(func))](
+                  std::atomic<bool>& cancel) mutable {
+    detail::fulfill(*promise, func, cancel);
+  };
+  return future;
+}
+
+template <typename F>
+auto dispatch(QueueRef queue, Task&& task, F&& func) {
+  auto future = bind(task, std::forward<F>(func));
+  queue.get()->enqueue(std::move(task));
+  return future;
+}
+
+}  // namespace detail
+
+// Runs |func| on |queue|. The returned future holds |func|'s result, it is
+// cancelled if |token| is cancelled before |func| starts.
+template <typename F>
+auto dispatchAsync(QueueRef queue, F&& func,
+    std::optional<CancellationToken> token, int priority = 0) {
+  return detail::dispatch(
+      queue, {priority, nullptr, std::move(token)}, std::forward<F>(func));
+}
+
+template <typename F>
+auto dispatchAsync(QueueRef queue, F&& func, int priority = 0) {
+  return dispatchAsync(queue, std::forward<F>(func), std::nullopt, priority);
+}
+
+template <typename F>
+auto dispatchAsync(F&& func) {
+  return dispatchAsync(kDefaultDispatchQueueId, std::forward<F>(func), 0);
+}
+
+// As dispatchAsync(), ordered by |deadline| on SchedulingMode::Deadline
+// queues. Late completions count towards missedDeadlineCount().
+template <typename F>
+auto dispatchBefore(QueueRef queue, deadline_t deadline, F&& func,
+    std::optional<CancellationToken> token = std::nullopt, int priority = 0) {
+  return detail::dispatch(queue, {priority, nullptr, std::move(token), deadline},
+      std::forward<F>(func));
+}
+
+// Runs |func| on |queue| once |delay| has elapsed. Cancelling |token|
+// drops the timer, the returned future is then cancelled on the timer thread
+// when the delay elapses at the latest.
+template <typename F>
+auto dispatchAfter(QueueRef queue, std::chrono::steady_clock::duration delay,
+    F&& func, std::optional<CancellationToken> token = std::nullopt,
+    int priority = 0) {
+  Task task{priority, nullptr, std::move(token)};
+  auto future = detail::bind(task, std::forward<F>(func));
+  timerWheel()->schedule(queue.get(), delay, {}, std::move(task));
+  return future;
+}
+
+// Runs |func| on |queue| every |period|, the first time after one period.
+// Runs may overlap if |func| takes longer than |period|. Cancel the returned
+// token, which is |token| when given, to stop.
+template <typename F>
+CancellationToken dispatchPeriodic(QueueRef queue,
+    std::chrono::steady_clock::duration period, F&& func,
+    CancellationToken token = {}, int priority = 0) {
+  if (period <= std::chrono::steady_clock::duration::zero()) {
+    throw std::invalid_argument("period must be positive.");
+  }
+  Task task{priority,
+      [func = detail::shareable(std::forward<F>(func))](
+          std::atomic<bool>& cancel) mutable { func(cancel); },
+      token};
+  timerWheel()->schedule(queue.get(), period, period, std::move(task));
+  return token;
+}
+
+// Ready once every future is ready. Fails with the first failure, otherwise
+// is cancelled if any of them was cancelled.
+template <typename T>
+Future<void> when_all(const std::vector<Future<T>>& futures) {
+  auto promise = std::make_shared<Promise<void>>();
+  Future<void> future = promise->future();
+  if (futures.empty()) {
+    promise->setValue();
+    return future;
+  }
+
+  // One copy shared by all continuations, not one per future.
+  auto all = std::make_shared<const std::vector<Future<T>>>(futures);
+  auto remaining = std::make_shared<std::atomic<size_t>>(futures.size());
+  for (const Future<T>& f : futures) {
+    f.subscribe([all, remaining, promise]() {
+      if (--*remaining > 0) {
+        return;
+      }
+      for (const Future<T>& f : *all) {
+        if (f.state_->status == detail::kFailed) {
+          promise->setException(f.state_->exception);
+          return;
+        }
+      }
+      for (const Future<T>& f : *all) {
+        if (f.cancelled()) {
+          promise->cancel();
+          return;
+        }
+      }
+      promise->setValue();
+    });
+  }
+  return future;
+}
+
+// Ready with the index of the first future to become ready.
+template <typename T>
+Future<size_t> when_any(const std::vector<Future<T>>& futures) {
+  auto promise = std::make_shared<Promise<size_t>>();
+  Future<size_t> future = promise->future();
+  if (futures.empty()) {
+    promise->cancel();
+    return future;
+  }
+
+  for (size_t i = 0; i < futures.size(); ++i) {
+    futures[i].subscribe([=]() { promise->setValue(i); });
+  }
+  return future;
+}
+
+namespace detail {
+
+// Lets a function returning Future<T> be a coroutine. The body starts eagerly
+// on the calling thread; throwing CancelledError cancels the future.
+template <typename T>
+struct CoroutinePromiseBase {
+  Promise<T> promise;
+
+  Future<T> get_return_object() { return promise.future(); }
+  std::suspend_never initial_suspend() noexcept { return {}; }
+  std::suspend_never final_suspend() noexcept { return {}; }
+  void unhandled_exception() {
+    try {
+      throw;
+    } catch (const CancelledError&) {
+      promise.cancel();
+    } catch (...) {
+      promise.setException(std::current_exception());
+    }
+  }
+};
+
+template <typename T>
+struct CoroutinePromise : CoroutinePromiseBase<T> {
+  void return_value(T value) { this->promise.setValue(std::move(value)); }
+};
+
+template <>
+struct CoroutinePromise<void> : CoroutinePromiseBase<void> {
+  void return_void() { this->promise.setValue(); }
+};
+
+// Owns a suspended coroutine until it is resumed. A resumption that is
+// dropped (queue cancelled, token cancelled) destroys the frame, which
+// cancels the coroutine's future.
+struct Resumption {
+  explicit Resumption(std::coroutine_handle<> handle) : handle(handle) {}
+  ~Resumption() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+  Resumption(const Resumption&) = delete;
+  Resumption& operator=(const Resumption&) = delete;
+
+  void resume() { std::exchange(handle, nullptr).resume(); }
+
+  std::coroutine_handle<> handle;
+};
+
+}  // namespace detail
+
+struct QueueAwaiter {
+  DispatchQueue* queue;
+  std::optional<CancellationToken> token;
+  int priority;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    auto resumption = std::make_shared<detail::Resumption>(handle);
+    queue->enqueue({priority,
+        [resumption](std::atomic<bool>&) { resumption->resume(); },
+        std::move(token)});
+  }
+  void await_resume() const noexcept {}
+};
+
+struct MainAwaiter {
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle);
+  void await_resume() const noexcept {}
+};
+
+// co_await task::on("decode") continues the coroutine on a worker of
+// |queue|. The coroutine is cancelled if |token| is cancelled meanwhile.
+inline QueueAwaiter on(QueueRef queue,
+    std::optional<CancellationToken> token = std::nullopt, int priority = 0) {
+  return {queue.get(), std::move(token), priority};
+}
+
+// co_await task::on_main() continues the coroutine on the main thread.
+inline MainAwaiter on_main() { return {}; }
+
+// Main thread hook, installed by the engine. dispatchMain() runs |func|
+// inline when no dispatcher is installed.
+using main_dispatcher_t = std::function<void(std::function<void()>)>;
+void setMainDispatcher(main_dispatcher_t dispatcher);
+void dispatchMain(std::function<void()> func);
+
+// Calls func(chunk_begin, chunk_end) over [begin, end) split into chunks of
+// at least |grain| items (0 picks one from the worker count). Chunks run on
+// the "parallel" queue and on the calling thread, which keeps executing
+// chunks instead of blocking, so nesting and calling from a worker is safe.
+// The first exception thrown by |func| is rethrown once all chunks are done.
+void parallel_for(size_t begin, size_t end,
+    const std::function<void(size_t, size_t)>& func, size_t grain = 0);
+
+// Chunk size parallel_for() uses for [begin, end).
+size_t parallel_chunk_size(size_t begin, size_t end, size_t grain = 0);
+
+// Folds func(chunk_begin, chunk_end, identity) results with |reduce|, in
+// chunk order.
+template <typename T, typename F, typename R>
+T parallel_reduce(
+    size_t begin, size_t end, T identity, F func, R reduce, size_t grain = 0) {
+  if (end <= begin) {
+    return identity;
+  }
+  const size_t step = parallel_chunk_size(begin, end, grain);
+  const size_t chunks = (end - begin + step - 1) / step;
+  std::vector<T> partials(chunks, identity);
+  parallel_for(
+      0, chunks,
+      [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+          const size_t b = begin + i * step;
+          partials[i] = func(b, std::min(end, b + step), identity);
+        }
+      },
+      1);
+
+  T result = std::move(partials[0]);
+  for (size_t i = 1; i < chunks; ++i) {
+    result = reduce(std::move(result), std::move(partials[i]));
+  }
+  return result;
+}
+
+// Stable sort. Chunks are sorted in parallel, then merged pairwise.
+template <typename It, typename Compare>
+void parallel_sort(It first, It last, Compare comp, size_t grain = 0) {
+  const size_t count = (size_t)std::distance(first, last);
+  const size_t step =
+      parallel_chunk_size(0, count, std::max<size_t>(grain, 1024));
+  const size_t chunks = (count + step - 1) / step;
+  if (chunks <= 1) {
+    std::stable_sort(first, last, comp);
+    return;
+  }
+
+  const auto at = [&](size_t i) { return first + std::min(count, i * step); };
+  parallel_for(
+      0, chunks,
+      [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+          std::stable_sort(at(i), at(i + 1), comp);
+        }
+      },
+      1);
+
+  for (size_t width = 1; width < chunks; width *= 2) {
+    const size_t merges = (chunks + 2 * width - 1) / (2 * width);
+    parallel_for(
+        0, merges,
+        [&](size_t b, size_t e) {
+          for (size_t i = b; i < e; ++i) {
+            const size_t lo = i * 2 * width;
+            if (lo + width < chunks) {
+              std::inplace_merge(at(lo), at(lo + width),
+                  at(std::min(chunks, lo + 2 * width)), comp);
+            }
+          }
+        },
+        1);
+  }
+}
+
+template <typename It>
+void parallel_sort(It first, It last) {
+  parallel_sort(first, last, std::less<>());
+}
+
+// Named cancellation groups. cancellationGroup() returns the group's current
+// token; cancelGroup() cancels everything issued so far under |tag| and starts
+// a fresh token for subsequent tasks.
+CancellationToken cancellationGroup(const char* tag);
+void cancelGroup(const char* tag);
 
-void dispatchAsync(const char* id, func_t func, int priority = 0);
-void dispatchAsync(func_t func);
 void enumerateDispatchQueues(std::function<void(const char*)> callback);
+void enumerateDispatchQueues(
+    std::function<void(const char*, const DispatchQueueStats&)> callback);
 
 }  // namespace task
 
@@ -25,9 +25,17 @@ enum class PixelFormat {
   RGBA16,
   RGBA32F,
   BGRA8,
+  RGBA16F,
   Unknown,
 };
 
+// Whether color channels are stored multiplied by alpha, in the encoding of
+// the color space.
+enum class AlphaMode {
+  Straight,
+  Premultiplied,
+};
+
 enum class TextureFilter {
   Nearest = 0,
   Bilinear = 1,
@@ -36,8 +44,10 @@ enum class TextureFilter {
 inline int getPixelFormatChannels(PixelFormat format) {
   switch (format) {
     case PixelFormat::RGBA8:
+    case PixelFormat::RGBA16:
     case PixelFormat::RGBA32F:
     case PixelFormat::BGRA8:
+    case PixelFormat::RGBA16F:
       return 4;
     default:
       assert(false && "unknown format.");
@@ -45,6 +55,23 @@ inline int getPixelFormatChannels(PixelFormat format) {
   }
 }
 
+// Bytes per pixel.
+inline size_t getPixelFormatSize(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::RGBA8:
+    case PixelFormat::BGRA8:
+      return 4;
+    case PixelFormat::RGBA16:
+    case PixelFormat::RGBA16F:
+      return 8;
+    case PixelFormat::RGBA32F:
+      return 16;
+    default:
+      assert(false && "unknown format.");
+      throw std::runtime_error("unknown format.");
+  }
+}
+
 class Color {
  public:
   Color() : r_(), g_(), b_(), a_() {}
@@ -2,6 +2,7 @@
 
 #include <variant>
 
+#include "../base/profiler.h"
 #include "../base/task.h"
 #include "../graphics/imgui/imgui_impl_win32.h"
 #include "../graphics/impl/context.h"
@@ -54,19 +55,30 @@ ImTextureID Texture::AsImGui() const {
   return texture_id;
 }
 
-Engine::Engine() {
+Engine::Engine()
+    : task_budget_(std::chrono::milliseconds(2)), task_stats_() {
   std::unique_ptr<Context> context(new Context());
   context_ = std::move(context);
+
+  task::setMainDispatcher(
+      [this](std::function<void()> task) { PostTask(std::move(task)); });
+  profiler::setThreadName("main");
 }
 
 Engine::~Engine() { Destroy(); }
 
 bool Engine::Tick() {
+  PROFILE_ZONE("Engine::Tick", "frame");
   if (window_) {
+    PROFILE_ZONE("Window::Update", "frame");
     if (!window_->Update()) {
       return false;
     }
   }
+  {
+    PROFILE_ZONE("Engine::runTasks", "frame");
+    runTasks();
+  }
   if (!render()) {
     return false;
   }
@@ -74,8 +86,13 @@ bool Engine::Tick() {
 }
 
 void Engine::Destroy() {
+  task::setMainDispatcher(nullptr);
   chaos::task::enumerateDispatchQueues(
       [](const char* name) { chaos::task::dispatchQueue(name)->wait(); });
+  {
+    std::lock_guard lock(tasks_mutex_);
+    tasks_ = {};
+  }
   imgui_font_atlas_.reset();
   context_.reset();
   window_.reset();
@@ -188,6 +205,47 @@ std::shared_ptr<Texture> Engine::CreateTexture(const texture_source_t& source) {
   return texture;
 }
 
+void Engine::PostTask(std::function<void()> task) {
+  std::lock_guard lock(tasks_mutex_);
+  tasks_.push_back(std::move(task));
+}
+
+void Engine::SetTaskBudget(std::chrono::microseconds budget) {
+  task_budget_ = budget;
+}
+
+TaskStats Engine::GetTaskStats() const { return task_stats_; }
+
+void Engine::runTasks() {
+  // Tasks posted while running wait for the next frame.
+  std::deque<std::function<void()>> tasks;
+  {
+    std::lock_guard lock(tasks_mutex_);
+    tasks.swap(tasks_);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  int executed = 0;
+  while (!tasks.empty()) {
+    if (executed > 0 && task_budget_.count() > 0 &&
+        std::chrono::steady_clock::now() - start >= task_budget_) {
+      break;
+    }
+    std::function<void()> task = std::move(tasks.front());
+    tasks.pop_front();
+    task();
+    executed++;
+  }
+
+  task_stats_ = {executed, (int)tasks.size()};
+  if (!tasks.empty()) {
+    // Leftovers go ahead of newly posted tasks.
+    std::lock_guard lock(tasks_mutex_);
+    std::move(tasks_.begin(), tasks_.end(), std::back_inserter(tasks));
+    tasks_.swap(tasks);
+  }
+}
+
 bool Engine::render() {
   static bool rendering = false;
   if (rendering) {
@@ -197,14 +255,21 @@ bool Engine::render() {
   rendering = true;
   try {
     if (imgui_render_func_) {
+      PROFILE_ZONE("ImGui", "frame");
       ImGui_ImplWin32_NewFrame();
       if (!imgui_render_func_()) {
         return false;
       }
     }
 
-    context_->Prepare();
-    context_->Render();
+    {
+      PROFILE_ZONE("Context::Prepare", "frame");
+      context_->Prepare();
+    }
+    {
+      PROFILE_ZONE("Context::Render", "frame");
+      context_->Render();
+    }
   } catch (std::exception& ex) {
     // unhandled exception.
     throw ex;
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -36,6 +38,13 @@ class Texture {
   std::shared_ptr<Resource> resource_;
 };
 
+// Main thread tasks of the last Tick().
+struct TaskStats {
+  int executed;
+  // Left over for the next frame once the budget ran out.
+  int deferred;
+};
+
 struct Scene {
   std::function<bool(Scene*)> imgui;
 };
@@ -65,8 +74,17 @@ class Engine {
   using texture_source_t = std::variant<std::string, std::shared_ptr<Image>>;
   std::shared_ptr<Texture> CreateTexture(const texture_source_t& source);
 
+  // Thread-safe, |task| runs on the main thread during a following Tick().
+  // Tasks run in posting order. Each Tick() stops starting tasks once
+  // |budget| is spent, at least one task runs per frame. Zero disables the
+  // budget.
+  void PostTask(std::function<void()> task);
+  void SetTaskBudget(std::chrono::microseconds budget);
+  TaskStats GetTaskStats() const;
+
  private:
   bool render();
+  void runTasks();
   bool windowEventFilter(window_event::window_event_t data);
   bool windowNativeEventFilter(void*, int, uint64_t, uint64_t);
 
@@ -75,7 +93,10 @@ class Engine {
 
   std::function<bool(window_event::window_event_t)> window_event_filter_;
   std::function<bool(int, uint64_t, uint64_t)> window_native_event_filter_;
-  std::queue<std::function<void()>> tasks_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex tasks_mutex_;
+  std::chrono::microseconds task_budget_;
+  TaskStats task_stats_;
 
   std::function<bool()> imgui_render_func_;
   std::shared_ptr<Texture> imgui_font_atlas_;
@@ -0,0 +1,120 @@
+// Measures ConcurrentLRUCache against an LRUCache behind one mutex, the way
+// callers shared a cache before. Prints CSV of throughput and hit rates:
+//
+//   cachebench [operations] [keys]
+//
+// Every thread replays its own Zipf-distributed key stream read-through: a
+// get which misses puts the key. The caches hold an eighth of the keys.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chaos/base/container.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The shared design, for reference.
+class MutexCache {
+ public:
+  explicit MutexCache(size_t capacity) : cache_(capacity) {}
+
+  void put(const uint64_t& key, const uint64_t& value) {
+    std::lock_guard lock(mutex_);
+    cache_.put(key, value);
+  }
+
+  bool get(const uint64_t& key, uint64_t& value) {
+    std::lock_guard lock(mutex_);
+    return cache_.get(key, value);
+  }
+
+  chaos::CacheStats stats() const {
+    std::lock_guard lock(mutex_);
+    return cache_.stats();
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  chaos::LRUCache<uint64_t, uint64_t> cache_;
+};
+
+struct Result {
+  double ops_per_second;
+  double hit_rate;
+};
+
+template <typename cache_t>
+Result run(cache_t& cache, const std::vector<std::vector<uint64_t>>& streams) {
+  std::atomic<int> ready(0);
+  const int threads = (int)streams.size();
+  const auto start = Clock::now();
+  {
+    std::vector<std::jthread> workers;
+    for (const std::vector<uint64_t>& stream : streams) {
+      workers.emplace_back([&] {
+        ready++;
+        while (ready < threads) {
+        }
+        uint64_t value;
+        for (uint64_t key : stream) {
+          if (!cache.get(key, value)) {
+            cache.put(key, key);
+          }
+        }
+      });
+    }
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return {(double)(streams[0].size() * threads) / seconds,
+      cache.stats().hitRate()};
+}
+
+int main(int argc, char* argv[]) {
+  const int operations =
+      argc > 1 ? std::max(1000, std::stoi(argv[1])) : 4000000;
+  const int keys = argc > 2 ? std::max(64, std::stoi(argv[2])) : 1 << 20;
+
+  // Key i is drawn with probability proportional to 1 / (i + 1)^0.9.
+  std::vector<double> weights(keys);
+  for (int i = 0; i < keys; ++i) {
+    weights[i] = 1.0 / std::pow(i + 1, 0.9);
+  }
+  std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+
+  std::printf("threads,cache,ops/s,hit rate\n");
+  const int hardware = std::max(2, (int)std::thread::hardware_concurrency());
+  for (int threads = 1; threads <= hardware * 2; threads *= 2) {
+    std::vector<std::vector<uint64_t>> streams(threads);
+    std::mt19937_64 random(threads);
+    for (std::vector<uint64_t>& stream : streams) {
+      stream.resize(operations / threads);
+      for (uint64_t& key : stream) {
+        key = (uint64_t)zipf(random);
+      }
+    }
+
+    Result result;
+    {
+      MutexCache cache(keys / 8);
+      result = run(cache, streams);
+    }
+    std::printf("%d,mutex,%.0f,%.3f\n", threads, result.ops_per_second,
+        result.hit_rate);
+    {
+      chaos::ConcurrentLRUCache<uint64_t, uint64_t> cache(keys / 8);
+      result = run(cache, streams);
+    }
+    std::printf("%d,sharded,%.0f,%.3f\n", threads, result.ops_per_second,
+        result.hit_rate);
+  }
+  return 0;
+}
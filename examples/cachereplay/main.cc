@@ -0,0 +1,81 @@
+// Replays a CacheTrace against a range of capacities and the eviction
+// policies, printing miss-ratio curves as CSV:
+//
+//   cachereplay <trace> [points]
+//
+// Gets are replayed read-through, a miss puts the key as the application
+// would. Capacities are in the trace's cost units and grow geometrically up
+// to the cost of all distinct keys.
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chaos/base/container.h"
+
+using chaos::CacheTrace;
+
+template <typename policy_t>
+double replay(const std::vector<CacheTrace::Access>& trace,
+    const std::unordered_map<uint64_t, size_t>& costs, size_t capacity) {
+  chaos::LRUCache<uint64_t, char, std::hash<uint64_t>, policy_t> cache(
+      capacity);
+  cache.setCostFunction(
+      [&costs](const uint64_t& key, const char&) { return costs.at(key); });
+  for (const CacheTrace::Access& access : trace) {
+    if (access.op == CacheTrace::Op::Put || !cache.find(access.key)) {
+      cache.put(access.key, 0);
+    }
+  }
+  return 1.0 - cache.stats().hitRate();
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: cachereplay <trace> [points]\n");
+    return 1;
+  }
+  const int points = argc > 2 ? std::max(2, std::stoi(argv[2])) : 16;
+
+  std::vector<CacheTrace::Access> trace;
+  try {
+    trace = CacheTrace::load(argv[1]);
+  } catch (const std::exception& ex) {
+    std::fprintf(stderr, "%s\n", ex.what());
+    return 1;
+  }
+
+  // Keys only ever read cost 1, the others what they were last put with.
+  std::unordered_map<uint64_t, size_t> costs;
+  for (const CacheTrace::Access& access : trace) {
+    if (access.op == CacheTrace::Op::Put) {
+      costs[access.key] = std::max<size_t>(access.cost, 1);
+    } else {
+      costs.try_emplace(access.key, 1);
+    }
+  }
+  size_t working_set = 0;
+  for (const auto& [key, cost] : costs) {
+    working_set += cost;
+  }
+  std::fprintf(stderr, "%zu accesses, %zu keys, working set %zu\n",
+      trace.size(), costs.size(), working_set);
+  if (working_set == 0) {
+    return 0;
+  }
+
+  std::printf("capacity,lru,2q,tinylfu\n");
+  for (int i = 1; i <= points; ++i) {
+    // From 1/1000 of the working set up to all of it.
+    const double fraction = std::pow(1000.0, (double)i / points) / 1000.0;
+    const size_t capacity =
+        std::max<size_t>(1, (size_t)(working_set * fraction));
+    std::printf("%zu,%.4f,%.4f,%.4f\n", capacity,
+        replay<chaos::LRUPolicy>(trace, costs, capacity),
+        replay<chaos::TwoQueuePolicy>(trace, costs, capacity),
+        replay<chaos::TinyLFUPolicy>(trace, costs, capacity));
+  }
+  return 0;
+}
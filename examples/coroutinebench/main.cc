@@ -0,0 +1,79 @@
+// Measures what coroutines on the dispatch queues cost. Prints CSV:
+//
+//   coroutinebench [iterations]
+//
+// call:     a coroutine returning without suspending, awaited by another.
+// hop:      co_await task::on() onto a one-thread queue, suspend to resume.
+// chain:    the same hops as tasks enqueuing the next, without a coroutine.
+// blocking: dispatchAsync() and wait() on the future from this thread.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "chaos/base/task.h"
+
+namespace task = chaos::task;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* kQueueId = "coroutinebench";
+
+task::Future<int> immediate(int value) { co_return value + 1; }
+
+task::Future<int> calls(int iterations) {
+  int sum = 0;
+  for (int i = 0; i < iterations; ++i) {
+    sum += co_await immediate(i);
+  }
+  co_return sum;
+}
+
+task::Future<void> hops(int iterations) {
+  for (int i = 0; i < iterations; ++i) {
+    co_await task::on(kQueueId);
+  }
+}
+
+void chain(int remaining, task::Promise<void>* done) {
+  if (remaining == 0) {
+    done->setValue();
+    return;
+  }
+  task::dispatchAsync(kQueueId,
+      [=](std::atomic<bool>&) { chain(remaining - 1, done); });
+}
+
+double nanosecondsPer(int iterations, const std::function<void()>& func) {
+  const auto start = Clock::now();
+  func();
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         iterations;
+}
+
+int main(int argc, char* argv[]) {
+  const int iterations = argc > 1 ? std::max(1, std::stoi(argv[1])) : 1000000;
+  task::dispatchQueue(kQueueId)->setThreadCount(1);
+
+  std::printf("mode,ns per op\n");
+  std::printf("call,%.1f\n",
+      nanosecondsPer(iterations, [&] { calls(iterations).wait(); }));
+  std::printf("hop,%.1f\n",
+      nanosecondsPer(iterations, [&] { hops(iterations).wait(); }));
+  std::printf("chain,%.1f\n", nanosecondsPer(iterations, [&] {
+    task::Promise<void> done;
+    task::Future<void> future = done.future();
+    chain(iterations, &done);
+    future.wait();
+  }));
+  // Each round trip sleeps and wakes this thread, keep it shorter.
+  const int round_trips = std::max(1, iterations / 10);
+  std::printf("blocking,%.1f\n", nanosecondsPer(round_trips, [&] {
+    for (int i = 0; i < round_trips; ++i) {
+      task::dispatchAsync(kQueueId, [](std::atomic<bool>&) {}).wait();
+    }
+  }));
+  return 0;
+}
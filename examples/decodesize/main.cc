@@ -0,0 +1,180 @@
+// Checks that Image::Load() with a preferred size returns the smallest image
+// at least that large. Prints CSV and exits with 1 on any mismatch:
+//
+//   decodesize [dir]
+//
+// Writes odd-sized PNG and JPEG files, decoded through WinRT, TGA through
+// stb and PPM through the pnm reader into |dir|, the temp directory by
+// default. One JPEG carries an EXIF orientation of 6, rotated a quarter
+// turn, so its requested and expected sizes are in the rotated frame.
+//
+// Readers reduce by halving and rounding up, the expected size is the last
+// of those halvings still at least the requested size in both dimensions.
+// A zero request leaves that dimension free.
+
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chaos/image/image.h"
+#include "chaos/image/stb_image_write.h"
+
+namespace fs = std::filesystem;
+
+// Oriented size of the smallest halving of |width| x |height| at least
+// |prefer_width| x |prefer_height|, the full size if none is.
+std::pair<int, int> expectedSize(
+    int width, int height, int prefer_width, int prefer_height) {
+  if (prefer_width <= 0 && prefer_height <= 0) {
+    return {width, height};
+  }
+  while (width > 1 || height > 1) {
+    const int half_width = (width + 1) / 2;
+    const int half_height = (height + 1) / 2;
+    if (half_width < prefer_width || half_height < prefer_height) {
+      break;
+    }
+    width = half_width;
+    height = half_height;
+  }
+  return {width, height};
+}
+
+std::vector<uint8_t> gradient(int width, int height) {
+  std::vector<uint8_t> rgba((size_t)width * height * 4);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      uint8_t* p = &rgba[((size_t)y * width + x) * 4];
+      p[0] = (uint8_t)(x * 255 / width);
+      p[1] = (uint8_t)(y * 255 / height);
+      p[2] = (uint8_t)((x + y) & 0xff);
+      p[3] = 255;
+    }
+  }
+  return rgba;
+}
+
+void writeFile(const fs::path& path, const std::vector<uint8_t>& bytes) {
+  std::ofstream(path, std::ios::binary)
+      .write((const char*)bytes.data(), bytes.size());
+}
+
+void appendBytes(void* context, void* data, int size) {
+  std::vector<uint8_t>* bytes = (std::vector<uint8_t>*)context;
+  bytes->insert(bytes->end(), (uint8_t*)data, (uint8_t*)data + size);
+}
+
+// APP1 segment of a little-endian TIFF header and one IFD holding the
+// Orientation tag, inserted after the SOI and JFIF APP0 markers.
+std::vector<uint8_t> withExifOrientation(
+    std::vector<uint8_t> jpeg, uint16_t orientation) {
+  const uint8_t app1[] = {0xff, 0xe1, 0x00, 0x22, 'E', 'x', 'i', 'f', 0, 0,
+      'I', 'I', 0x2a, 0x00, 0x08, 0x00, 0x00, 0x00,  // TIFF header
+      0x01, 0x00,                                    // one entry
+      0x12, 0x01, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00,  // Orientation, SHORT
+      (uint8_t)orientation, (uint8_t)(orientation >> 8), 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00};  // no next IFD
+  size_t at = 2;
+  if (jpeg.size() > 6 && jpeg[2] == 0xff && jpeg[3] == 0xe0) {
+    at += 2 + (jpeg[4] << 8 | jpeg[5]);
+  }
+  jpeg.insert(jpeg.begin() + at, std::begin(app1), std::end(app1));
+  return jpeg;
+}
+
+struct Sample {
+  std::string name;
+  int width;
+  int height;
+  // Stored as is and tagged with EXIF orientation 6, shown rotated a
+  // quarter turn clockwise.
+  bool rotated = false;
+};
+
+void writeSample(const fs::path& path, const Sample& sample) {
+  const std::vector<uint8_t> rgba = gradient(sample.width, sample.height);
+  const std::string ext = path.extension().string();
+  std::vector<uint8_t> bytes;
+  if (ext == ".png") {
+    bytes = chaos::Image::Save(
+        std::make_unique<chaos::Image>(sample.width, sample.height,
+            (size_t)sample.width * 4, chaos::PixelFormat::RGBA8, 4,
+            chaos::ColorSpace::sRGB, std::vector<uint8_t>(rgba))
+            .get(),
+        "png");
+  } else if (ext == ".jpg") {
+    stbi_write_jpg_to_func(&appendBytes, &bytes, sample.width, sample.height,
+        4, rgba.data(), 95);
+    if (sample.rotated) {
+      bytes = withExifOrientation(std::move(bytes), 6);
+    }
+  } else if (ext == ".tga") {
+    stbi_write_tga_to_func(
+        &appendBytes, &bytes, sample.width, sample.height, 4, rgba.data());
+  } else if (ext == ".ppm") {
+    const std::string header = "P6\n" + std::to_string(sample.width) + " " +
+                               std::to_string(sample.height) + "\n255\n";
+    bytes.assign(header.begin(), header.end());
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+      bytes.insert(bytes.end(), &rgba[i], &rgba[i] + 3);
+    }
+  }
+  writeFile(path, bytes);
+}
+
+int main(int argc, char* argv[]) {
+  const fs::path dir =
+      argc > 1 ? fs::path(argv[1]) : fs::temp_directory_path() / "decodesize";
+  fs::create_directories(dir);
+
+  const std::vector<Sample> samples = {
+      {"wide.png", 1001, 667},
+      {"wide.jpg", 1001, 667},
+      {"tall.jpg", 333, 777},
+      {"rotated.jpg", 1001, 667, true},
+      {"wide.tga", 1001, 667},
+      {"strip.tga", 4097, 3},
+      {"wide.ppm", 1001, 667},
+  };
+  const int requests[][2] = {{0, 0}, {1, 1}, {500, 0}, {0, 100}, {251, 167},
+      {250, 84}, {126, 126}, {501, 334}, {1001, 667}, {2000, 2000}};
+
+  int failures = 0;
+  std::printf("file,requested,decoded,expected,ok\n");
+  for (const Sample& sample : samples) {
+    const fs::path path = dir / sample.name;
+    writeSample(path, sample);
+    const int width = sample.rotated ? sample.height : sample.width;
+    const int height = sample.rotated ? sample.width : sample.height;
+    for (const auto& request : requests) {
+      const auto [expected_width, expected_height] =
+          expectedSize(width, height, request[0], request[1]);
+      int decoded_width = 0;
+      int decoded_height = 0;
+      try {
+        std::unique_ptr<chaos::Image> image =
+            chaos::Image::Load(path.string(), 0, request[0], request[1]);
+        if (image) {
+          decoded_width = image->width();
+          decoded_height = image->height();
+        }
+      } catch (const std::exception& ex) {
+        std::fprintf(stderr, "%s: %s\n", sample.name.c_str(), ex.what());
+      }
+      const bool ok = decoded_width == expected_width &&
+                      decoded_height == expected_height;
+      failures += !ok;
+      std::printf("%s,%dx%d,%dx%d,%dx%d,%s\n", sample.name.c_str(), request[0],
+          request[1], decoded_width, decoded_height, expected_width,
+          expected_height, ok ? "yes" : "NO");
+    }
+  }
+  std::fprintf(stderr, "%d mismatches\n", failures);
+  return failures ? 1 : 0;
+}
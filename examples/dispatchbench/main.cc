@@ -0,0 +1,160 @@
+// Measures DispatchQueue throughput and enqueue-to-start latency against a
+// queue built like the one it replaced: one mutex around a priority queue,
+// with every worker woken after each pop. Prints CSV:
+//
+//   dispatchbench [tasks]
+//
+// One producer enqueues the tasks as fast as it can, so latencies include
+// the backlog. Tiny tasks do nothing, large ones spin for about 20 us.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chaos/base/task.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The replaced design, for reference.
+class MutexQueue {
+ public:
+  explicit MutexQueue(int threads) {
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back([this] { workerThread(); });
+    }
+  }
+
+  ~MutexQueue() {
+    {
+      std::lock_guard lock(mutex_);
+      exit_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  void enqueue(chaos::task::Task&& task) {
+    {
+      std::lock_guard lock(mutex_);
+      pq_.push(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  void wait() {
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [&] { return pq_.empty() && running_ == 0; });
+  }
+
+ private:
+  struct Comparer {
+    bool operator()(const chaos::task::Task& a, const chaos::task::Task& b) {
+      return a.priority > b.priority;
+    }
+  };
+
+  void workerThread() {
+    std::atomic<bool> cancel(false);
+    while (true) {
+      chaos::task::Task task;
+      {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [&] { return exit_ || !pq_.empty(); });
+        if (exit_) {
+          return;
+        }
+        task = pq_.top();
+        pq_.pop();
+        running_++;
+      }
+      cv_.notify_all();
+      task.func(cancel);
+      {
+        std::lock_guard lock(mutex_);
+        running_--;
+      }
+      cv_.notify_all();
+    }
+  }
+
+  std::priority_queue<chaos::task::Task, std::vector<chaos::task::Task>,
+      Comparer>
+      pq_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool exit_ = false;
+  int running_ = 0;
+  std::vector<std::jthread> workers_;
+};
+
+void spin(std::chrono::nanoseconds duration) {
+  const auto end = Clock::now() + duration;
+  while (Clock::now() < end) {
+  }
+}
+
+struct Result {
+  double tasks_per_second;
+  double p50_us;
+  double p99_us;
+};
+
+template <typename queue_t>
+Result run(queue_t& queue, int tasks, std::chrono::nanoseconds work) {
+  std::vector<Clock::duration> latencies(tasks);
+  const auto start = Clock::now();
+  for (int i = 0; i < tasks; ++i) {
+    chaos::task::Task task{};
+    task.func = [&latencies, i, work,
+                    enqueued = Clock::now()](std::atomic<bool>&) {
+      latencies[i] = Clock::now() - enqueued;
+      spin(work);
+    };
+    queue.enqueue(std::move(task));
+  }
+  queue.wait();
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::sort(latencies.begin(), latencies.end());
+  const auto us = [](Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  };
+  return {tasks / seconds, us(latencies[tasks / 2]),
+      us(latencies[tasks * 99 / 100])};
+}
+
+int main(int argc, char* argv[]) {
+  const int tasks = argc > 1 ? std::max(100, std::stoi(argv[1])) : 100000;
+
+  std::printf("threads,task,queue,tasks/s,p50 us,p99 us\n");
+  for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+    for (const auto& [label, work] :
+        {std::pair{"tiny", std::chrono::nanoseconds(0)},
+            std::pair{"large", std::chrono::nanoseconds(20000)}}) {
+      // Large tasks take long enough at low thread counts, keep them short.
+      const int count = work.count() ? tasks / 10 : tasks;
+      Result result;
+      {
+        MutexQueue queue(threads);
+        result = run(queue, count, work);
+      }
+      std::printf("%d,%s,mutex,%.0f,%.1f,%.1f\n", threads, label,
+          result.tasks_per_second, result.p50_us, result.p99_us);
+      {
+        chaos::task::DispatchQueue queue("dispatchbench");
+        queue.setThreadCount(threads);
+        result = run(queue, count, work);
+      }
+      std::printf("%d,%s,stealing,%.0f,%.1f,%.1f\n", threads, label,
+          result.tasks_per_second, result.p50_us, result.p99_us);
+    }
+  }
+  return 0;
+}
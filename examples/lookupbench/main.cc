@@ -0,0 +1,84 @@
+// Measures what resolving a dispatch queue by id costs against the map it
+// replaced: a std::string built from the id and looked up in an
+// unordered_map. Prints CSV of nanoseconds per lookup:
+//
+//   lookupbench [lookups]
+//
+// map:      std::string key and unordered_map::find().
+// registry: dispatchQueue(id).
+// handle:   a QueueRef made from a DispatchQueue* resolved once.
+//
+// Rows vary the number of named queues, ids cycle through short ones which
+// fit the small string buffer and long ones which do not.
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chaos/base/task.h"
+
+namespace task = chaos::task;
+
+using Clock = std::chrono::steady_clock;
+
+double nanosecondsPer(int lookups, const std::function<size_t()>& func) {
+  const auto start = Clock::now();
+  volatile size_t sink = func();
+  (void)sink;
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         lookups;
+}
+
+int main(int argc, char* argv[]) {
+  const int lookups = argc > 1 ? std::max(1, std::stoi(argv[1])) : 10000000;
+
+  std::vector<std::string> ids;
+  std::unordered_map<std::string, task::DispatchQueue*> map;
+  std::printf("queues,map ns,registry ns,handle ns\n");
+  for (int queues : {1, 8, 64, 512}) {
+    while ((int)ids.size() < queues) {
+      const int n = (int)ids.size();
+      ids.push_back(n % 2 ? "lookupbench." + std::to_string(n) + ".io.uploads"
+                          : "q" + std::to_string(n));
+      map[ids.back()] = task::dispatchQueue(ids.back());
+    }
+    std::vector<const char*> names;
+    std::vector<task::DispatchQueue*> handles;
+    for (const std::string& id : ids) {
+      names.push_back(id.c_str());
+      handles.push_back(task::dispatchQueue(id));
+    }
+    const size_t mask = std::bit_floor(names.size()) - 1;
+
+    const double map_ns = nanosecondsPer(lookups, [&] {
+      size_t sum = 0;
+      for (int i = 0; i < lookups; ++i) {
+        sum += (size_t)map.find(names[i & mask])->second;
+      }
+      return sum;
+    });
+    const double registry_ns = nanosecondsPer(lookups, [&] {
+      size_t sum = 0;
+      for (int i = 0; i < lookups; ++i) {
+        sum += (size_t)task::dispatchQueue(names[i & mask]);
+      }
+      return sum;
+    });
+    const double handle_ns = nanosecondsPer(lookups, [&] {
+      size_t sum = 0;
+      for (int i = 0; i < lookups; ++i) {
+        sum += (size_t)task::QueueRef(handles[i & mask]).get();
+      }
+      return sum;
+    });
+    std::printf("%d,%.1f,%.1f,%.1f\n", queues, map_ns, registry_ns,
+        handle_ns);
+  }
+  return 0;
+}
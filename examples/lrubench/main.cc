@@ -0,0 +1,118 @@
+// Measures LRUCache against the std::list and std::unordered_map design it
+// replaced, on one thread. Prints CSV of throughput and hit rates:
+//
+//   lrubench [operations]
+//
+// For 1K to 1M entries, a Zipf-distributed stream over four times as many
+// keys is replayed read-through: a get which misses puts the key. Both
+// caches evict least recently used entries, so their hit rates match.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chaos/base/container.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The replaced design, for reference.
+class ListCache {
+ public:
+  explicit ListCache(size_t capacity) : capacity_(capacity) {}
+
+  void put(const uint64_t& key, const uint64_t& value) {
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+      list_.erase(it->second);
+      map_.erase(it);
+    }
+    list_.push_front(std::make_pair(key, value));
+    map_.insert({key, list_.begin()});
+    while (map_.size() > capacity_) {
+      map_.erase(list_.back().first);
+      list_.pop_back();
+    }
+  }
+
+  bool get(const uint64_t& key, uint64_t& value) {
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      stats_.misses++;
+      return false;
+    }
+    list_.splice(list_.begin(), list_, it->second);
+    value = it->second->second;
+    stats_.hits++;
+    return true;
+  }
+
+  const chaos::CacheStats& stats() const { return stats_; }
+
+ private:
+  using entry_t = std::pair<uint64_t, uint64_t>;
+
+  std::list<entry_t> list_;
+  std::unordered_map<uint64_t, std::list<entry_t>::iterator> map_;
+  size_t capacity_;
+  chaos::CacheStats stats_;
+};
+
+struct Result {
+  double ops_per_second;
+  double hit_rate;
+};
+
+template <typename cache_t>
+Result run(cache_t& cache, const std::vector<uint64_t>& stream) {
+  const auto start = Clock::now();
+  uint64_t value;
+  for (uint64_t key : stream) {
+    if (!cache.get(key, value)) {
+      cache.put(key, key);
+    }
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return {(double)stream.size() / seconds, cache.stats().hitRate()};
+}
+
+int main(int argc, char* argv[]) {
+  const int operations =
+      argc > 1 ? std::max(1000, std::stoi(argv[1])) : 10000000;
+
+  std::printf("entries,cache,ops/s,hit rate\n");
+  for (int entries = 1000; entries <= 1000000; entries *= 10) {
+    // Key i is drawn with probability proportional to 1 / (i + 1)^0.9.
+    std::vector<double> weights(entries * 4);
+    for (size_t i = 0; i < weights.size(); ++i) {
+      weights[i] = 1.0 / std::pow(i + 1, 0.9);
+    }
+    std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+    std::mt19937_64 random(entries);
+    std::vector<uint64_t> stream(operations);
+    for (uint64_t& key : stream) {
+      key = (uint64_t)zipf(random);
+    }
+
+    Result result;
+    {
+      ListCache cache(entries);
+      result = run(cache, stream);
+    }
+    std::printf("%d,list,%.0f,%.3f\n", entries, result.ops_per_second,
+        result.hit_rate);
+    {
+      chaos::LRUCache<uint64_t, uint64_t> cache(entries);
+      result = run(cache, stream);
+    }
+    std::printf("%d,flat,%.0f,%.3f\n", entries, result.ops_per_second,
+        result.hit_rate);
+  }
+  return 0;
+}
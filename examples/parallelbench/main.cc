@@ -0,0 +1,146 @@
+// Measures how the parallel primitives scale with the "parallel" queue's
+// thread count. Prints CSV of milliseconds and speedups:
+//
+//   parallelbench [megapixels]
+//
+// for:      parallel_for brightening an RGBA8 buffer of that many pixels.
+// reduce:   parallel_reduce summing it.
+// sort:     parallel_sort of one 32-bit key per pixel.
+// bilinear,
+// lanczos3: Image::Resize() of it to half its width and height.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chaos/base/task.h"
+#include "chaos/image/image.h"
+
+namespace task = chaos::task;
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(const std::function<void()>& func) {
+  // Best of three, the first run also faults the pages in.
+  double best = 1e300;
+  for (int i = 0; i < 3; ++i) {
+    const auto start = Clock::now();
+    func();
+    best = std::min(best,
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count());
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  const double megapixels = argc > 1 ? std::stod(argv[1]) : 100.0;
+  const int width = (int)std::sqrt(megapixels * 1e6 * 4 / 3);
+  const int height = width * 3 / 4;
+  const size_t pixels = (size_t)width * height;
+
+  std::vector<uint8_t> rgba(pixels * 4);
+  std::vector<uint32_t> keys(pixels);
+  std::mt19937 random(1);
+  for (size_t i = 0; i < pixels; ++i) {
+    keys[i] = random();
+    std::memcpy(&rgba[i * 4], &keys[i], 4);
+  }
+  std::vector<uint32_t> sorted(pixels);
+  auto image = std::make_unique<chaos::Image>(width, height, (size_t)width * 4,
+      chaos::PixelFormat::RGBA8, 4, chaos::ColorSpace::sRGB,
+      std::vector<uint8_t>(rgba));
+
+  // One thread runs the serial loops, the queue keeps at least one worker.
+  struct Case {
+    const char* name;
+    std::function<void(bool parallel)> run;
+    // Resizes split their rows themselves and have no serial run.
+    bool has_serial = true;
+    double first = 0.0;
+  };
+  std::vector<Case> cases = {
+      {"for",
+          [&](bool parallel) {
+            const auto brighten = [&](size_t begin, size_t end) {
+              for (size_t i = begin * 4; i < end * 4; ++i) {
+                rgba[i] = (uint8_t)std::min(255, rgba[i] + 1);
+              }
+            };
+            if (parallel) {
+              task::parallel_for(0, pixels, brighten);
+            } else {
+              brighten(0, pixels);
+            }
+          }},
+      {"reduce",
+          [&](bool parallel) {
+            const auto sum = [&](size_t begin, size_t end, uint64_t sum) {
+              for (size_t i = begin; i < end; ++i) {
+                sum += rgba[i];
+              }
+              return sum;
+            };
+            volatile uint64_t total =
+                parallel ? task::parallel_reduce(size_t(0), rgba.size(),
+                               uint64_t(0), sum, std::plus<uint64_t>())
+                         : sum(0, rgba.size(), 0);
+            (void)total;
+          }},
+      {"sort",
+          [&](bool parallel) {
+            sorted = keys;
+            if (parallel) {
+              task::parallel_sort(sorted.begin(), sorted.end());
+            } else {
+              std::stable_sort(sorted.begin(), sorted.end());
+            }
+          }},
+      {"bilinear",
+          [&](bool) {
+            image->Resize(width / 2, height / 2,
+                chaos::ResizeFilter::Bilinear);
+          },
+          false},
+      {"lanczos3",
+          [&](bool) {
+            image->Resize(width / 2, height / 2,
+                chaos::ResizeFilter::Lanczos3);
+          },
+          false},
+  };
+
+  std::fprintf(stderr, "%dx%d, %u hardware threads\n", width, height,
+      std::thread::hardware_concurrency());
+  // Creates the queue before its size is changed.
+  task::parallel_for(0, 1, [](size_t, size_t) {});
+
+  // Speedups are over the first row of each case, one thread or two.
+  std::printf("threads,case,ms,speedup\n");
+  const int hardware = std::max(2, (int)std::thread::hardware_concurrency());
+  for (int threads = 1; threads <= hardware; threads *= 2) {
+    // The calling thread runs chunks too.
+    task::dispatchQueue(task::kParallelDispatchQueueId)
+        ->setThreadCount(std::max(1, threads - 1));
+    for (Case& c : cases) {
+      if (threads == 1 && !c.has_serial) {
+        continue;
+      }
+      const double ms =
+          milliseconds([&] { c.run(threads > 1); });
+      if (c.first == 0.0) {
+        c.first = ms;
+      }
+      std::printf("%d,%s,%.2f,%.2f\n", threads, c.name, ms, c.first / ms);
+    }
+  }
+  return 0;
+}
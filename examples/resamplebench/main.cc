@@ -0,0 +1,228 @@
+// Compares resizeSeparable() with the vendored stb_image_resize on RGBA8,
+// error against a double-precision reference and time. Prints CSV:
+//
+//   resamplebench [megapixels]
+//
+// A noise image of that many megapixels is scaled to a quarter and to twice
+// its width and height with Box, Mitchell and Lanczos3, in sRGB and in
+// linear light. stb_image_resize has no Lanczos. Errors are in 8-bit steps,
+// exact rounding of the reference is 0.5 at most.
+//
+// The reference filters like resizeSeparable(): taps falling off the image
+// are dropped and the rest renormalized. stb_image_resize clamps to the
+// edge instead and upscales with a box around each output pixel, so its
+// large errors near the borders and in box upscales are differences in
+// definition, not in precision.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <numbers>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "chaos/image/resize.h"
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "chaos/image/stb_image_resize.h"
+
+using Clock = std::chrono::steady_clock;
+
+double mitchell(double x) {
+  constexpr double B = 1.0 / 3.0;
+  constexpr double C = 1.0 / 3.0;
+  x = std::abs(x);
+  if (x < 1.0) {
+    return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x +
+               (6 - 2 * B)) /
+           6;
+  }
+  if (x < 2.0) {
+    return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+               (-12 * B - 48 * C) * x + (8 * B + 24 * C)) /
+           6;
+  }
+  return 0.0;
+}
+
+double lanczos3(double x) {
+  x = std::abs(x);
+  if (x < 1e-9) {
+    return 1.0;
+  }
+  if (x >= 3.0) {
+    return 0.0;
+  }
+  const double p = std::numbers::pi * x;
+  return 3.0 * std::sin(p) * std::sin(p / 3.0) / (p * p);
+}
+
+// Normalized weights of the source pixels under one output pixel.
+struct Taps {
+  int first;
+  std::vector<double> weights;
+};
+
+std::vector<Taps> taps(chaos::ResizeFilter filter, int src, int dst) {
+  const double scale = (double)src / dst;
+  // Downscaling stretches the filter over the source pixels.
+  const double stretch = std::max(1.0, scale);
+  const double support =
+      (filter == chaos::ResizeFilter::Box         ? 0.5
+          : filter == chaos::ResizeFilter::Mitchell ? 2.0
+                                                    : 3.0) *
+      stretch;
+  std::vector<Taps> result(dst);
+  for (int i = 0; i < dst; ++i) {
+    const double center = (i + 0.5) * scale;
+    const int first = std::max(0, (int)std::floor(center - support));
+    const int last = std::min(src - 1, (int)std::ceil(center + support));
+    Taps& t = result[i];
+    t.first = first;
+    double sum = 0.0;
+    for (int j = first; j <= last; ++j) {
+      double w;
+      if (filter == chaos::ResizeFilter::Box) {
+        // Coverage of the source pixel by the output pixel's box.
+        w = std::max(0.0, std::min(j + 1.0, center + support) -
+                              std::max((double)j, center - support));
+      } else {
+        const double x = (j + 0.5 - center) / stretch;
+        w = filter == chaos::ResizeFilter::Mitchell ? mitchell(x)
+                                                    : lanczos3(x);
+      }
+      t.weights.push_back(w);
+      sum += w;
+    }
+    for (double& w : t.weights) {
+      w /= sum;
+    }
+  }
+  return result;
+}
+
+double toLinear(double v) {
+  return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+}
+
+double toSRGB(double v) {
+  return v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1 / 2.4) - 0.055;
+}
+
+// Filters rows horizontally as the output rows need them, then vertically.
+// Values are in 0..255.
+std::vector<double> reference(const std::vector<uint8_t>& src, int sw, int sh,
+    int dw, int dh, chaos::ResizeFilter filter, bool linear_light) {
+  const std::vector<Taps> tx = taps(filter, sw, dw);
+  const std::vector<Taps> ty = taps(filter, sh, dh);
+  std::vector<std::vector<double>> rows(sh);
+  const auto row = [&](int y) -> const std::vector<double>& {
+    std::vector<double>& r = rows[y];
+    if (r.empty()) {
+      r.resize((size_t)dw * 4);
+      for (int x = 0; x < dw; ++x) {
+        for (int c = 0; c < 4; ++c) {
+          double sum = 0.0;
+          for (size_t k = 0; k < tx[x].weights.size(); ++k) {
+            double v =
+                src[((size_t)y * sw + tx[x].first + k) * 4 + c] / 255.0;
+            if (linear_light && c < 3) {
+              v = toLinear(v);
+            }
+            sum += tx[x].weights[k] * v;
+          }
+          r[(size_t)x * 4 + c] = sum;
+        }
+      }
+    }
+    return r;
+  };
+
+  std::vector<double> dst((size_t)dw * dh * 4);
+  for (int y = 0; y < dh; ++y) {
+    // Output rows move down the source, rows above their taps are done.
+    for (int j = 0; j < ty[y].first; ++j) {
+      std::vector<double>().swap(rows[j]);
+    }
+    for (size_t i = 0; i < (size_t)dw * 4; ++i) {
+      double sum = 0.0;
+      for (size_t k = 0; k < ty[y].weights.size(); ++k) {
+        sum += ty[y].weights[k] * row(ty[y].first + (int)k)[i];
+      }
+      sum = std::clamp(sum, 0.0, 1.0);
+      if (linear_light && i % 4 < 3) {
+        sum = toSRGB(sum);
+      }
+      dst[(size_t)y * dw * 4 + i] = sum * 255.0;
+    }
+  }
+  return dst;
+}
+
+int main(int argc, char* argv[]) {
+  const double megapixels = argc > 1 ? std::stod(argv[1]) : 4.0;
+  const int width = (int)std::sqrt(megapixels * 1e6 * 4 / 3);
+  const int height = width * 3 / 4;
+
+  std::vector<uint8_t> src((size_t)width * height * 4);
+  std::mt19937 random(1);
+  for (uint8_t& v : src) {
+    v = (uint8_t)random();
+  }
+
+  std::printf("filter,linear,size,impl,ms,max err,mean err\n");
+  for (const auto& [dw, dh] : {std::pair{width / 4, height / 4},
+           std::pair{width * 2, height * 2}}) {
+    std::vector<uint8_t> dst((size_t)dw * dh * 4);
+    for (const auto& [name, filter, stb_filter] :
+        {std::tuple{"box", chaos::ResizeFilter::Box, STBIR_FILTER_BOX},
+            std::tuple{"mitchell", chaos::ResizeFilter::Mitchell,
+                STBIR_FILTER_MITCHELL},
+            std::tuple{"lanczos3", chaos::ResizeFilter::Lanczos3,
+                STBIR_FILTER_DEFAULT}}) {
+      for (bool linear_light : {false, true}) {
+        const std::vector<double> golden =
+            reference(src, width, height, dw, dh, filter, linear_light);
+        const auto report = [&](const char* impl,
+                                const std::function<void()>& resize) {
+          const auto start = Clock::now();
+          resize();
+          const double ms =
+              std::chrono::duration<double, std::milli>(Clock::now() - start)
+                  .count();
+          double max_error = 0.0;
+          double sum_error = 0.0;
+          for (size_t i = 0; i < dst.size(); ++i) {
+            const double error = std::abs(dst[i] - golden[i]);
+            max_error = std::max(max_error, error);
+            sum_error += error;
+          }
+          std::printf("%s,%d,%dx%d,%s,%.1f,%.3f,%.4f\n", name, linear_light,
+              dw, dh, impl, ms, max_error, sum_error / dst.size());
+        };
+
+        report("chaos", [&] {
+          chaos::resizeSeparable(chaos::PixelFormat::RGBA8, src.data(), width,
+              height, (size_t)width * 4, dst.data(), dw, dh, (size_t)dw * 4,
+              filter, linear_light);
+        });
+        if (stb_filter == STBIR_FILTER_DEFAULT) {
+          continue;
+        }
+        // Alpha is filtered as is, like resizeSeparable() does.
+        report("stbir", [&] {
+          stbir_resize_uint8_generic(src.data(), width, height, width * 4,
+              dst.data(), dw, dh, dw * 4, 4, 3, STBIR_FLAG_ALPHA_PREMULTIPLIED,
+              STBIR_EDGE_CLAMP, stb_filter,
+              linear_light ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR,
+              nullptr);
+        });
+      }
+    }
+  }
+  return 0;
+}
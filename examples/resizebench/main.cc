@@ -0,0 +1,202 @@
+// Checks the nearest and bilinear resize kernels against golden images and
+// measures every SIMD level against the scalar kernels. Prints CSV of
+// milliseconds and speedups:
+//
+//   resizebench [megapixels]
+//
+// The check runs first, on odd sizes up and down for RGBA8, RGBA16 and
+// RGBA32F, at every level the CPU supports. Nearest must pick exactly the
+// source pixel whose center is closest; bilinear must be within half a step
+// of a double-precision reference, and every level must match the scalar
+// output. Failures are printed to stderr and make the exit code 1.
+//
+// The timing resizes a source of that many megapixels to half and to twice
+// its width and height.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "chaos/image/resize.h"
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* kLevelNames[] = {"scalar", "sse4.1", "avx2"};
+
+// Source coordinate and weight of the second tap along one axis, centers
+// aligned and clamped to the edges.
+void bilinearTaps(int i, int src, int dst, int& i0, int& i1, double& w) {
+  const double f =
+      std::clamp((i + 0.5) * src / dst - 0.5, 0.0, (double)(src - 1));
+  i0 = std::min((int)f, src - 1);
+  i1 = std::min(i0 + 1, src - 1);
+  w = f - i0;
+}
+
+int nearestTap(int i, int src, int dst) {
+  return (int)std::min<int64_t>(
+      (2 * (int64_t)i + 1) * src / (2 * (int64_t)dst), src - 1);
+}
+
+// Returns the number of failed comparisons, each level and filter against
+// the golden image and the scalar output.
+template <typename T>
+int check(chaos::PixelFormat format, const char* format_name, int sw, int sh,
+    int dw, int dh) {
+  constexpr bool kFloat = std::is_floating_point_v<T>;
+  std::mt19937 random(sw * 31 + dw);
+  std::vector<T> src((size_t)sw * sh * 4);
+  for (T& v : src) {
+    v = kFloat ? (T)(random() % 100000) / 1000.0f
+               : (T)(random() >> (32 - 8 * sizeof(T)));
+  }
+  const auto at = [](const std::vector<T>& image, int w, int x, int y,
+                      int c) {
+    return (double)image[((size_t)y * w + x) * 4 + c];
+  };
+  // Integers round, floats only differ by how the SIMD kernels associate.
+  const auto close = [](double a, double b, double steps) {
+    return std::abs(a - b) <=
+           (kFloat ? 1e-5 * std::max(1.0, std::abs(b)) : steps);
+  };
+
+  const auto golden = [&](bool nearest, int x, int y, int c) {
+    if (nearest) {
+      return at(src, sw, nearestTap(x, sw, dw), nearestTap(y, sh, dh), c);
+    }
+    int x0, x1, y0, y1;
+    double wx, wy;
+    bilinearTaps(x, sw, dw, x0, x1, wx);
+    bilinearTaps(y, sh, dh, y0, y1, wy);
+    const double top =
+        std::lerp(at(src, sw, x0, y0, c), at(src, sw, x1, y0, c), wx);
+    const double bottom =
+        std::lerp(at(src, sw, x0, y1, c), at(src, sw, x1, y1, c), wx);
+    return std::lerp(top, bottom, wy);
+  };
+
+  int failures = 0;
+  const auto fail = [&](const char* filter, int level, const char* what) {
+    if (failures++ < 8) {
+      std::fprintf(stderr, "FAIL %s %dx%d -> %dx%d %s %s: %s\n", format_name,
+          sw, sh, dw, dh, filter, kLevelNames[level], what);
+    }
+  };
+
+  for (const auto& [name, resize] :
+      {std::pair{"nearest", &chaos::resizeNearest},
+          std::pair{"bilinear", &chaos::resizeBilinear}}) {
+    const bool nearest = resize == &chaos::resizeNearest;
+    std::vector<T> scalar;
+    for (int level = 0; level <= (int)chaos::getSimdLevel(); ++level) {
+      chaos::setSimdLevel((chaos::SimdLevel)level);
+      // One guard pixel past the end catches overruns.
+      std::vector<T> dst((size_t)dw * dh * 4 + 4, (T)77);
+      resize(format, (const uint8_t*)src.data(), sw, sh, sw * 4 * sizeof(T),
+          (uint8_t*)dst.data(), dw, dh, dw * 4 * sizeof(T));
+      if (dst[(size_t)dw * dh * 4] != (T)77) {
+        fail(name, level, "wrote past the image");
+      }
+      if (level == 0) {
+        scalar = dst;
+      } else {
+        for (size_t i = 0; i < dst.size(); ++i) {
+          if (!close(dst[i], scalar[i], 0.0)) {
+            fail(name, level, "differs from scalar");
+            break;
+          }
+        }
+      }
+
+      int off = 0;
+      for (int y = 0; y < dh; ++y) {
+        for (int x = 0; x < dw; ++x) {
+          for (int c = 0; c < 4; ++c) {
+            // Fixed-point weights may add a little to the rounding.
+            off += !close(at(dst, dw, x, y, c), golden(nearest, x, y, c),
+                nearest ? 0.0 : 0.51);
+          }
+        }
+      }
+      if (off) {
+        fail(name, level, "differs from golden");
+      }
+    }
+  }
+  chaos::setSimdLevel(chaos::getSimdLevel());
+  return failures;
+}
+
+double milliseconds(const std::function<void()>& func) {
+  // Best of three, the first run also faults the pages in.
+  double best = 1e300;
+  for (int i = 0; i < 3; ++i) {
+    const auto start = Clock::now();
+    func();
+    best = std::min(best,
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count());
+  }
+  return best;
+}
+
+template <typename T>
+void benchmark(
+    chaos::PixelFormat format, const char* format_name, int sw, int sh) {
+  std::vector<T> src((size_t)sw * sh * 4, (T)3);
+  for (const auto& [name, resize] :
+      {std::pair{"nearest", &chaos::resizeNearest},
+          std::pair{"bilinear", &chaos::resizeBilinear}}) {
+    for (const auto& [dw, dh] : {std::pair{sw / 2, sh / 2},
+             std::pair{sw * 2, sh * 2}}) {
+      std::vector<T> dst((size_t)dw * dh * 4);
+      double scalar = 0.0;
+      for (int level = 0; level <= (int)chaos::getSimdLevel(); ++level) {
+        chaos::setSimdLevel((chaos::SimdLevel)level);
+        const double ms = milliseconds([&] {
+          resize(format, (const uint8_t*)src.data(), sw, sh,
+              sw * 4 * sizeof(T), (uint8_t*)dst.data(), dw, dh,
+              dw * 4 * sizeof(T));
+        });
+        if (level == 0) {
+          scalar = ms;
+        }
+        std::printf("%s,%s,%dx%d,%s,%.2f,%.2f\n", format_name, name, dw,
+            dh, kLevelNames[level], ms, scalar / ms);
+      }
+    }
+  }
+  chaos::setSimdLevel(chaos::getSimdLevel());
+}
+
+int main(int argc, char* argv[]) {
+  const double megapixels = argc > 1 ? std::stod(argv[1]) : 12.0;
+  const int width = (int)std::sqrt(megapixels * 1e6 * 4 / 3);
+  const int height = width * 3 / 4;
+
+  int failures = 0;
+  const int sizes[][4] = {{37, 23, 101, 57}, {101, 57, 37, 23},
+      {1, 1, 5, 3}, {64, 64, 64, 64}, {300, 7, 13, 200}, {257, 129, 64, 31}};
+  for (const auto& s : sizes) {
+    failures += check<uint8_t>(
+        chaos::PixelFormat::RGBA8, "rgba8", s[0], s[1], s[2], s[3]);
+    failures += check<uint16_t>(
+        chaos::PixelFormat::RGBA16, "rgba16", s[0], s[1], s[2], s[3]);
+    failures += check<float>(
+        chaos::PixelFormat::RGBA32F, "rgba32f", s[0], s[1], s[2], s[3]);
+  }
+  std::fprintf(stderr, "golden check: %d failures, up to %s\n", failures,
+      kLevelNames[(int)chaos::getSimdLevel()]);
+
+  std::printf("format,filter,size,level,ms,speedup\n");
+  benchmark<uint8_t>(chaos::PixelFormat::RGBA8, "rgba8", width, height);
+  benchmark<uint16_t>(chaos::PixelFormat::RGBA16, "rgba16", width, height);
+  benchmark<float>(chaos::PixelFormat::RGBA32F, "rgba32f", width, height);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+// Measures the producer-side cost of handing tasks to a DispatchQueue, one
+// enqueue() per task against enqueueBulk() and the lock-free submit().
+// Prints CSV of nanoseconds per task:
+//
+//   submitbench [tasks] [threads]
+//
+// Every producer submits its share of the tasks to a queue of |threads|
+// workers running empty tasks, timed until the last one is handed over.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chaos/base/task.h"
+
+namespace task = chaos::task;
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mode { Enqueue, Bulk, Submit };
+
+double nanosecondsPerTask(Mode mode, int producers, int tasks, int threads) {
+  task::DispatchQueue queue("submitbench");
+  queue.setThreadCount(threads);
+  if (mode == Mode::Submit) {
+    queue.setSubmissionRing(4096);
+  }
+
+  const int share = tasks / producers;
+  std::vector<std::vector<task::Task>> batches(producers);
+  for (std::vector<task::Task>& batch : batches) {
+    batch.resize(share);
+    for (task::Task& t : batch) {
+      t.func = [](std::atomic<bool>&) {};
+    }
+  }
+
+  std::atomic<int> ready(0);
+  std::vector<Clock::duration> elapsed(producers);
+  std::vector<std::jthread> workers;
+  for (int p = 0; p < producers; ++p) {
+    workers.emplace_back([&, p] {
+      // Start together so the producers contend.
+      ready++;
+      while (ready < producers) {
+      }
+      std::vector<task::Task>& batch = batches[p];
+      const auto start = Clock::now();
+      switch (mode) {
+        case Mode::Enqueue:
+          for (task::Task& t : batch) {
+            queue.enqueue(std::move(t));
+          }
+          break;
+        case Mode::Bulk:
+          queue.enqueueBulk(std::span<task::Task>(batch));
+          break;
+        case Mode::Submit:
+          for (task::Task& t : batch) {
+            queue.submit(std::move(t));
+          }
+          break;
+      }
+      elapsed[p] = Clock::now() - start;
+    });
+  }
+  workers.clear();
+  queue.wait();
+
+  const Clock::duration slowest =
+      *std::max_element(elapsed.begin(), elapsed.end());
+  return std::chrono::duration<double, std::nano>(slowest).count() / share;
+}
+
+int main(int argc, char* argv[]) {
+  const int tasks = argc > 1 ? std::max(64, std::stoi(argv[1])) : 200000;
+  const int threads =
+      std::max(1, argc > 2 ? std::stoi(argv[2])
+                           : (int)std::thread::hardware_concurrency());
+
+  std::printf("producers,enqueue ns,bulk ns,submit ns\n");
+  for (int producers : {1, 2, 4, 8}) {
+    std::printf("%d,%.1f,%.1f,%.1f\n", producers,
+        nanosecondsPerTask(Mode::Enqueue, producers, tasks, threads),
+        nanosecondsPerTask(Mode::Bulk, producers, tasks, threads),
+        nanosecondsPerTask(Mode::Submit, producers, tasks, threads));
+  }
+  return 0;
+}
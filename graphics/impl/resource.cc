@@ -59,9 +59,10 @@ void Resource::UnmapStaging() { staging_resource_->Unmap(0, NULL); }
 
 ResourceGC::ResourceGC() {}
 
-ResourceGC::~ResourceGC() { 
-  Cleanup(UINT64_MAX); 
-  chaos::task::dispatchQueue("gc")->wait();
+ResourceGC::~ResourceGC() {
+  cleanup_.wait();
+  Cleanup(UINT64_MAX);
+  cleanup_.wait();
 }
 
 void ResourceGC::Add(const Resource& resource, uint64_t fencevalue) {
@@ -81,12 +82,19 @@ void ResourceGC::Add(const Resource& resource, uint64_t fencevalue) {
 
 void ResourceGC::Cleanup(uint64_t fencevalue) {
   std::lock_guard lock(mutex_);
+
+  // The previous cleanup is still running, the next frame picks these up.
+  if (cleanup_.valid() && !cleanup_.ready()) {
+    return;
+  }
+
   size_t count = std::count_if(resources_.begin(), resources_.end(),
       [fencevalue](
           const Garbage& garbage) { return garbage.fencevalue < fencevalue; });
   if (count > 0) {
 #if 1
-    chaos::task::dispatchAsync("gc", [&](std::atomic<bool>&) {
+    cleanup_ = chaos::task::dispatchAsync(
+        "gc", [this, fencevalue](std::atomic<bool>&) {
       std::lock_guard lock(mutex_);
       size_t deleted =
           std::erase_if(resources_, [fencevalue](const Garbage& garbage) {
@@ -6,6 +6,7 @@
 
 #include "d3d12def.h"
 #include "descriptorheap.h"
+#include "../../base/task.h"
 #include "../../base/types.h"
 
 namespace chaos {
@@ -37,6 +38,9 @@ struct ResourceFormat {
     else if (format == PixelFormat::RGBA32F) {
       return ResourceFormat::RGBA32F();
     }
+    else if (format == PixelFormat::RGBA16F) {
+      return ResourceFormat::RGBA16F();
+    }
     else if (format == PixelFormat::RGBA8) {
       return ResourceFormat::RGBA8();
     }
@@ -135,6 +139,7 @@ class ResourceGC {
     uint64_t fencevalue;
   };
   std::vector<Garbage> resources_;
+  task::Future<void> cleanup_;
 };
 
 }  // namespace chaos
@@ -19,6 +19,8 @@ void TextRenderer::Init(Engine* engine, const std::vector<std::string>& fonts) {
   std::lock_guard lock(mutex_);
 
   cache_.clear();
+  cache_stats_ = {};
+  cache_age_ = {};
   engine_ = engine;
   dwrite_ = std::unique_ptr<simpledwrite::SimpleDWrite>(new simpledwrite::SimpleDWrite());
 
@@ -41,11 +43,13 @@ bool TextRenderer::RenderImGui(const std::string& id, const std::string& text, s
     const auto& cache = cache_.at(id);
     if (cache.hash == hash) {
       if (cache.layout.font_size == layout->font_size) {
-        if (cache.rendering) {
+        if (!cache.rendering.ready()) {
+          cache_stats_.pending++;
           ImGui::Dummy(
               {(float)cache.layout.font_size, (float)cache.layout.font_size});
           return false;
         } else {
+          cache_stats_.hits++;
           std::shared_ptr<Texture> texture = cache.texture;
           if (texture) {
             PushOutline(false);
@@ -55,17 +59,27 @@ bool TextRenderer::RenderImGui(const std::string& id, const std::string& text, s
             *layout = cache.layout;
             return true;
           }
+          return false;
         }
       }
     }
   }
 
-  Cache& cache = cache_[id];
-  cache.rendering = true;
+  auto [it, inserted] = cache_.try_emplace(id);
+  Cache& cache = it->second;
+  cache_stats_.misses++;
+  if (!inserted) {
+    cache_age_.remove(cache.put_time);
+    if (cache.texture) {
+      cache_stats_.evictions++;
+    }
+  }
+  cache.put_time = detail::AgeTracker::now();
+  cache_age_.add(cache.put_time);
   cache.hash = hash;
   cache.layout = *layout;
 
-  task::dispatchAsync("text", [=](std::atomic<bool>&) {
+  cache.rendering = task::dispatchAsync("text", [=](std::atomic<bool>&) {
     thread_local std::vector<uint8_t> buffer_;
 
     simpledwrite::Layout layout;
@@ -116,7 +130,6 @@ bool TextRenderer::RenderImGui(const std::string& id, const std::string& text, s
     {
       std::lock_guard lock(mutex_);
       cache_[id].texture = texture;
-      cache_[id].rendering = false;
       cache_[id].layout = layout;
     }
     return true;
@@ -125,6 +138,20 @@ bool TextRenderer::RenderImGui(const std::string& id, const std::string& text, s
   return false;
 }
 
+CacheStats TextRenderer::GetCacheStats() const {
+  std::lock_guard lock(mutex_);
+  CacheStats stats = cache_stats_;
+  stats.entries = cache_.size();
+  for (const auto& [id, cache] : cache_) {
+    if (cache.texture) {
+      stats.bytes += getPixelFormatSize(cache.texture->format) *
+                     cache.texture->width * cache.texture->height;
+    }
+  }
+  stats.mean_age = cache_age_.mean(cache_.size());
+  return stats;
+}
+
 }  // namespace ui
 
 }  // namespace chaos
@@ -5,6 +5,8 @@
 #include <string>
 #include <unordered_map>
 
+#include "../base/container.h"
+#include "../base/task.h"
 #include "../extras/simpledwrite.h"
 
 namespace chaos {
@@ -23,6 +25,10 @@ class TextRenderer {
   bool RenderImGui(const std::string& id, const std::string& text,
       simpledwrite::Layout* layout);
 
+  // Hits are texts drawn from the cache, pending those still rendering and
+  // evictions re-rendered textures.
+  CacheStats GetCacheStats() const;
+
  private:
   Engine* engine_;
   std::unique_ptr<simpledwrite::SimpleDWrite> dwrite_;
@@ -30,11 +36,14 @@ class TextRenderer {
   struct Cache {
     uint64_t hash = 0;
     std::shared_ptr<chaos::Texture> texture;
-    bool rendering = false;
+    task::Future<bool> rendering;
     simpledwrite::Layout layout;
+    double put_time = 0.0;
   };
   std::unordered_map<std::string, Cache> cache_;
-  std::mutex mutex_;
+  CacheStats cache_stats_;
+  detail::AgeTracker cache_age_;
+  mutable std::mutex mutex_;
   std::mutex mutex_render_;
 };
 
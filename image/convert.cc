@@ -0,0 +1,520 @@
+#include "convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <immintrin.h>
+
+#include "base/task.h"
+
+#include "resize.h"
+
+namespace chaos {
+
+namespace {
+
+// Pixels per parallel_for() chunk, smaller images run on fewer threads.
+constexpr size_t kPixelsPerChunk = 32 * 1024;
+
+// linearToSrgbFast() samples, interpolation error shrinks with their square.
+constexpr int kEncodeSteps = 16384;
+
+const std::vector<float>& encodeTable() {
+  static const std::vector<float> table = [] {
+    std::vector<float> t(kEncodeSteps + 2);
+    for (int i = 0; i < kEncodeSteps + 2; ++i) {
+      t[i] = linearToSrgb(std::min(1.0f, (float)i / kEncodeSteps));
+    }
+    return t;
+  }();
+  return table;
+}
+
+// Normalized linear values of every 8 or 16-bit sRGB code.
+template <int kMax>
+const float* decodeTable() {
+  static const std::vector<float> table = [] {
+    std::vector<float> t(kMax + 1);
+    for (int i = 0; i <= kMax; ++i) {
+      t[i] = srgbToLinear((float)i / kMax);
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+// NaN clamps to 0 like the SIMD stores.
+inline float saturate(float v) { return v > 0.0f ? std::min(v, 1.0f) : 0.0f; }
+
+inline float encodeFast(const float* table, float v) {
+  const float f = saturate(v) * kEncodeSteps;
+  const int i = (int)f;
+  return table[i] + (table[i + 1] - table[i]) * (f - i);
+}
+
+struct Plan {
+  PixelEncoding from;
+  PixelEncoding to;
+  // Premultiplied colors leave and enter alpha in their own color space.
+  bool unpremultiply;
+  bool premultiply;
+  bool to_linear;
+  bool to_srgb;
+  // Applied while loading integer codes instead of transferring after.
+  const float* decode;
+};
+
+Plan makePlan(const PixelEncoding& from, const PixelEncoding& to) {
+  Plan plan{};
+  plan.from = from;
+  plan.to = to;
+  const bool transfer = from.cs != to.cs;
+  plan.unpremultiply = from.alpha == AlphaMode::Premultiplied &&
+                       (to.alpha == AlphaMode::Straight || transfer);
+  plan.premultiply = to.alpha == AlphaMode::Premultiplied &&
+                     (from.alpha == AlphaMode::Straight || transfer);
+  plan.to_linear = transfer && to.cs == ColorSpace::Linear;
+  plan.to_srgb = transfer && to.cs == ColorSpace::sRGB;
+  plan.decode = nullptr;
+  if (plan.to_linear && !plan.unpremultiply) {
+    if (from.format == PixelFormat::RGBA8 ||
+        from.format == PixelFormat::BGRA8) {
+      plan.decode = decodeTable<255>();
+    } else if (from.format == PixelFormat::RGBA16) {
+      plan.decode = decodeTable<65535>();
+    }
+  }
+  return plan;
+}
+
+// Loads, normalized RGBA.
+
+CHAOS_TARGET("sse4.1")
+void loadBytesSse(const uint8_t* src, float* out, int width, bool bgra) {
+  const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+  for (int x = 0; x < width; ++x) {
+    int v;
+    ::memcpy(&v, src + x * 4, 4);
+    __m128 p = _mm_mul_ps(
+        _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v))), scale);
+    if (bgra) {
+      p = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+    _mm_storeu_ps(out + x * 4, p);
+  }
+}
+
+CHAOS_TARGET("sse4.1")
+void loadShortsSse(const uint8_t* src, float* out, int width) {
+  const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+  for (int x = 0; x < width; ++x) {
+    const __m128i v =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + x * 8));
+    _mm_storeu_ps(out + x * 4,
+        _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(v)), scale));
+  }
+}
+
+CHAOS_TARGET("f16c")
+void loadHalfF16c(const uint8_t* src, float* out, int width) {
+  for (int x = 0; x < width; ++x) {
+    const __m128i v =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + x * 8));
+    _mm_storeu_ps(out + x * 4, _mm_cvtph_ps(v));
+  }
+}
+
+// With |decode| color codes are looked up instead of normalized.
+template <typename code_t>
+void loadCodes(const uint8_t* src, float* out, int width, bool bgra,
+    const float* decode) {
+  constexpr float kScale = 1.0f / (code_t)~0;
+  for (int x = 0; x < width; ++x) {
+    code_t v[4];
+    ::memcpy(v, src + x * sizeof(v), sizeof(v));
+    if (bgra) {
+      std::swap(v[0], v[2]);
+    }
+    for (int c = 0; c < 3; ++c) {
+      out[x * 4 + c] = decode ? decode[v[c]] : v[c] * kScale;
+    }
+    out[x * 4 + 3] = v[3] * kScale;
+  }
+}
+
+void loadRow(const Plan& plan, const uint8_t* src, float* out, int width,
+    SimdLevel level) {
+  switch (plan.from.format) {
+    case PixelFormat::RGBA8:
+    case PixelFormat::BGRA8: {
+      const bool bgra = plan.from.format == PixelFormat::BGRA8;
+      if (!plan.decode && level != SimdLevel::Scalar) {
+        loadBytesSse(src, out, width, bgra);
+      } else {
+        loadCodes<uint8_t>(src, out, width, bgra, plan.decode);
+      }
+      break;
+    }
+    case PixelFormat::RGBA16:
+      if (!plan.decode && level != SimdLevel::Scalar) {
+        loadShortsSse(src, out, width);
+      } else {
+        loadCodes<uint16_t>(src, out, width, false, plan.decode);
+      }
+      break;
+    case PixelFormat::RGBA16F:
+      if (level == SimdLevel::AVX2) {
+        loadHalfF16c(src, out, width);
+      } else {
+        for (int i = 0; i < width * 4; ++i) {
+          uint16_t h;
+          ::memcpy(&h, src + i * 2, 2);
+          out[i] = halfToFloat(h);
+        }
+      }
+      break;
+    default:
+      ::memcpy(out, src, (size_t)width * 16);
+      break;
+  }
+}
+
+// Stores, clamping integers.
+
+CHAOS_TARGET("sse4.1")
+void storeBytesSse(const float* in, uint8_t* dst, int width, bool bgra) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+  for (int x = 0; x < width; ++x) {
+    // max() first turns NaN into 0.
+    __m128 p = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + x * 4), zero), one);
+    if (bgra) {
+      p = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+    __m128i i = _mm_cvtps_epi32(_mm_mul_ps(p, scale));
+    i = _mm_packus_epi32(i, i);
+    const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+    ::memcpy(dst + x * 4, &packed, 4);
+  }
+}
+
+CHAOS_TARGET("sse4.1")
+void storeShortsSse(const float* in, uint8_t* dst, int width) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(65535.0f);
+  for (int x = 0; x < width; ++x) {
+    const __m128 p =
+        _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + x * 4), zero), one);
+    __m128i i = _mm_cvtps_epi32(_mm_mul_ps(p, scale));
+    _mm_storel_epi64(
+        reinterpret_cast<__m128i*>(dst + x * 8), _mm_packus_epi32(i, i));
+  }
+}
+
+CHAOS_TARGET("f16c")
+void storeHalfF16c(const float* in, uint8_t* dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 8),
+        _mm_cvtps_ph(_mm_loadu_ps(in + x * 4), _MM_FROUND_TO_NEAREST_INT));
+  }
+}
+
+// Rounds half to even like the SIMD conversions.
+template <typename code_t>
+void storeCodes(const float* in, uint8_t* dst, int width, bool bgra) {
+  constexpr float kMax = (code_t)~0;
+  for (int x = 0; x < width; ++x) {
+    code_t v[4];
+    for (int c = 0; c < 4; ++c) {
+      v[c] = (code_t)std::nearbyint(saturate(in[x * 4 + c]) * kMax);
+    }
+    if (bgra) {
+      std::swap(v[0], v[2]);
+    }
+    ::memcpy(dst + x * sizeof(v), v, sizeof(v));
+  }
+}
+
+void storeRow(const Plan& plan, const float* in, uint8_t* dst, int width,
+    SimdLevel level) {
+  switch (plan.to.format) {
+    case PixelFormat::RGBA8:
+    case PixelFormat::BGRA8: {
+      const bool bgra = plan.to.format == PixelFormat::BGRA8;
+      if (level != SimdLevel::Scalar) {
+        storeBytesSse(in, dst, width, bgra);
+      } else {
+        storeCodes<uint8_t>(in, dst, width, bgra);
+      }
+      break;
+    }
+    case PixelFormat::RGBA16:
+      if (level != SimdLevel::Scalar) {
+        storeShortsSse(in, dst, width);
+      } else {
+        storeCodes<uint16_t>(in, dst, width, false);
+      }
+      break;
+    case PixelFormat::RGBA16F:
+      if (level == SimdLevel::AVX2) {
+        storeHalfF16c(in, dst, width);
+      } else {
+        for (int i = 0; i < width * 4; ++i) {
+          const uint16_t h = floatToHalf(in[i]);
+          ::memcpy(dst + i * 2, &h, 2);
+        }
+      }
+      break;
+    default:
+      ::memcpy(dst, in, (size_t)width * 16);
+      break;
+  }
+}
+
+// Alpha
+
+// Transparent pixels keep their colors.
+CHAOS_TARGET("sse4.1")
+void unpremultiplySse(float* row, int width) {
+  const __m128 zero = _mm_setzero_ps();
+  for (int x = 0; x < width; ++x) {
+    const __m128 p = _mm_loadu_ps(row + x * 4);
+    const __m128 a = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128 q = _mm_blendv_ps(p, _mm_div_ps(p, a), _mm_cmpgt_ps(a, zero));
+    _mm_storeu_ps(row + x * 4, _mm_blend_ps(q, p, 0x8));
+  }
+}
+
+CHAOS_TARGET("sse4.1")
+void premultiplySse(float* row, int width) {
+  for (int x = 0; x < width; ++x) {
+    const __m128 p = _mm_loadu_ps(row + x * 4);
+    const __m128 a = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(row + x * 4, _mm_blend_ps(_mm_mul_ps(p, a), p, 0x8));
+  }
+}
+
+void unpremultiplyScalar(float* row, int width) {
+  for (int x = 0; x < width; ++x) {
+    const float a = row[x * 4 + 3];
+    if (a > 0.0f) {
+      for (int c = 0; c < 3; ++c) {
+        row[x * 4 + c] /= a;
+      }
+    }
+  }
+}
+
+void premultiplyScalar(float* row, int width) {
+  for (int x = 0; x < width; ++x) {
+    for (int c = 0; c < 3; ++c) {
+      row[x * 4 + c] *= row[x * 4 + 3];
+    }
+  }
+}
+
+void convertRow(const Plan& plan, const uint8_t* src, uint8_t* dst,
+    float* row, int width, SimdLevel level) {
+  loadRow(plan, src, row, width, level);
+  const bool simd = level != SimdLevel::Scalar;
+  if (plan.unpremultiply && simd) {
+    unpremultiplySse(row, width);
+  } else if (plan.unpremultiply) {
+    unpremultiplyScalar(row, width);
+  }
+  if (plan.to_linear && !plan.decode) {
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        row[x * 4 + c] = srgbToLinear(row[x * 4 + c]);
+      }
+    }
+  } else if (plan.to_srgb) {
+    // Integers are clamped anyway, the table is exact enough for them.
+    const float* table = plan.to.format != PixelFormat::RGBA32F &&
+                                 plan.to.format != PixelFormat::RGBA16F
+                             ? encodeTable().data()
+                             : nullptr;
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        float& v = row[x * 4 + c];
+        v = table ? encodeFast(table, v) : linearToSrgb(v);
+      }
+    }
+  }
+  if (plan.premultiply && simd) {
+    premultiplySse(row, width);
+  } else if (plan.premultiply) {
+    premultiplyScalar(row, width);
+  }
+  storeRow(plan, row, dst, width, level);
+}
+
+// RGBA8 and BGRA8 only differ in order.
+
+void swizzleScalar(const uint8_t* src, uint8_t* dst, int first, int width) {
+  for (int x = first; x < width; ++x) {
+    const uint8_t p[4] = {src[x * 4 + 2], src[x * 4 + 1], src[x * 4 + 0],
+        src[x * 4 + 3]};
+    ::memcpy(dst + x * 4, p, 4);
+  }
+}
+
+CHAOS_TARGET("sse4.1")
+void swizzleSse(const uint8_t* src, uint8_t* dst, int width) {
+  const __m128i order =
+      _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + x * 4), _mm_shuffle_epi8(v, order));
+  }
+  swizzleScalar(src, dst, x, width);
+}
+
+CHAOS_TARGET("avx2")
+void swizzleAvx2(const uint8_t* src, uint8_t* dst, int width) {
+  const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8,
+      11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 4));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4),
+        _mm256_shuffle_epi8(v, order));
+  }
+  swizzleSse(src + x * 4, dst + x * 4, width - x);
+}
+
+}  // namespace
+
+float srgbToLinear(float v) {
+  return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float v) {
+  return v <= 0.0031308f ? v * 12.92f
+                         : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+
+float linearToSrgbFast(float v) {
+  return encodeFast(encodeTable().data(), v);
+}
+
+float halfToFloat(uint16_t h) {
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    // Zero or subnormal, mantissa * 2^-24.
+    const float v = mantissa * (1.0f / 16777216.0f);
+    return sign ? -v : v;
+  }
+  uint32_t bits;
+  if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float f;
+  ::memcpy(&f, &bits, 4);
+  return f;
+}
+
+uint16_t floatToHalf(float f) {
+  uint32_t bits;
+  ::memcpy(&bits, &f, 4);
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs = bits & 0x7fffffff;
+  if (abs > 0x7f800000) {
+    // Quiet NaN.
+    return sign | 0x7e00;
+  }
+  // From 65520 on rounds up past the largest half.
+  if (abs >= 0x477ff000) {
+    return sign | 0x7c00;
+  }
+  // Below 2^-14 halves are subnormal, steps of 2^-24.
+  if (abs < 0x38800000) {
+    float a;
+    ::memcpy(&a, &abs, 4);
+    return sign | (uint16_t)std::nearbyint(a * 16777216.0f);
+  }
+  // Rebias the exponent, rounding the dropped mantissa bits to even.
+  const uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+  return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+void convertPixels(const PixelEncoding& from, const uint8_t* src,
+    size_t src_stride, const PixelEncoding& to, uint8_t* dst,
+    size_t dst_stride, int width, int height) {
+  if (!src || !dst || width <= 0 || height <= 0 ||
+      from.format == PixelFormat::Unknown ||
+      to.format == PixelFormat::Unknown) {
+    throw std::invalid_argument("invalid conversion.");
+  }
+  const size_t src_size = getPixelFormatSize(from.format);
+  const size_t dst_size = getPixelFormatSize(to.format);
+  const bool in_place = src == dst;
+  if (in_place && (src_size != dst_size || src_stride != dst_stride)) {
+    throw std::invalid_argument("in place conversion changes the layout.");
+  }
+
+  const SimdLevel level = activeSimdLevel();
+  const size_t grain = std::max<size_t>(1, kPixelsPerChunk / (size_t)width);
+  const bool same = from.cs == to.cs && from.alpha == to.alpha;
+  if (same && from.format == to.format) {
+    if (!in_place) {
+      task::parallel_for(
+          0, height,
+          [&](size_t y0, size_t y1) {
+            for (size_t y = y0; y < y1; ++y) {
+              ::memcpy(dst + y * dst_stride, src + y * src_stride,
+                  dst_size * width);
+            }
+          },
+          grain);
+    }
+    return;
+  }
+  if (same && src_size == 4 && dst_size == 4) {
+    task::parallel_for(
+        0, height,
+        [&](size_t y0, size_t y1) {
+          for (size_t y = y0; y < y1; ++y) {
+            const uint8_t* s = src + y * src_stride;
+            uint8_t* d = dst + y * dst_stride;
+            if (level == SimdLevel::AVX2) {
+              swizzleAvx2(s, d, width);
+            } else if (level == SimdLevel::SSE41) {
+              swizzleSse(s, d, width);
+            } else {
+              swizzleScalar(s, d, 0, width);
+            }
+          }
+        },
+        grain);
+    return;
+  }
+
+  const Plan plan = makePlan(from, to);
+  task::parallel_for(
+      0, height,
+      [&](size_t y0, size_t y1) {
+        // Whole rows are loaded before any is stored, so in place works.
+        std::vector<float> row((size_t)width * 4);
+        for (size_t y = y0; y < y1; ++y) {
+          convertRow(plan, src + y * src_stride, dst + y * dst_stride,
+              row.data(), width, level);
+        }
+      },
+      grain);
+}
+
+}  // namespace chaos
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../base/types.h"
+
+namespace chaos {
+
+// How pixels are stored.
+struct PixelEncoding {
+  PixelFormat format;
+  ColorSpace cs;
+  AlphaMode alpha;
+};
+
+// Converts |width| x |height| pixels from |src| to |dst|, rows |src_stride|
+// and |dst_stride| bytes apart, splitting rows over the parallel queue.
+// Integer formats hold values normalized to their maximum and clamp, floats
+// do not. Premultiplied colors are divided by alpha before a color space
+// change and multiplied again after. |src| and |dst| may be the same memory
+// when the pixel sizes and the strides match.
+void convertPixels(const PixelEncoding& from, const uint8_t* src,
+    size_t src_stride, const PixelEncoding& to, uint8_t* dst,
+    size_t dst_stride, int width, int height);
+
+// sRGB transfer on values normalized to 1, both extend linearly below 0.
+float srgbToLinear(float v);
+float linearToSrgb(float v);
+// linearToSrgb() of |v| clamped to [0, 1], interpolated from a table to
+// within a 16-bit code.
+float linearToSrgbFast(float v);
+
+float halfToFloat(uint16_t h);
+// Rounds to nearest even, overflowing to infinity.
+uint16_t floatToHalf(float f);
+
+}  // namespace chaos
@@ -1,8 +1,14 @@
 #include "image.h"
 
+#include <atomic>
 #include <cassert>
+#include <mutex>
 
 #include "base/minlog.h"
+#include "base/task.h"
+
+#include "convert.h"
+#include "resize.h"
 
 // readers
 #include "pnm_rw.h"
@@ -12,124 +18,8 @@
 
 namespace chaos {
 
-inline size_t getPitch(PixelFormat format, int width) noexcept {
-  if (format == PixelFormat::RGBA8) {
-    return width * 4;
-  } else if (format == PixelFormat::RGBA16) {
-    return width * 2 * 4;
-  } else if (format == PixelFormat::RGBA32F) {
-    return width * 4 * 4;
-  }
-  assert(false && "not implemented.");
-  return width * 4 * 4;
-}
-
-struct uchar4 {
-  uchar4() = default;
-  uchar4(uint8_t x, uint8_t y, uint8_t z, uint8_t w) : x(x), y(y), z(z), w(w) {}
-  uint8_t x, y, z, w;
-  template <typename T>
-  uchar4 operator+(T v) {
-    return {x + v, y + v, z * v, w * v};
-  }
-  template <typename T>
-  uchar4 operator-(T v) {
-    return {x - v, y - v, z - v, w - v};
-  }
-  template <typename T>
-  uchar4 operator*(T v) {
-    return {x * v, y * v, z * v, w * v};
-  }
-  template <typename T>
-  uchar4 operator/(T v) {
-    return {x / v, y / v, z / v, w / v};
-  }
-};
-
-struct ushort4 {
-  ushort4() = default;
-  ushort4(uint16_t x, uint16_t y, uint16_t z, uint16_t w) : x(x), y(y), z(z), w(w) {}
-  uint16_t x, y, z, w;
-  template <typename T>
-  ushort4 operator+(T v) {
-    return {x + v, y + v, z * v, w * v};
-  }
-  template <typename T>
-  ushort4 operator-(T v) {
-    return {x - v, y - v, z - v, w - v};
-  }
-  template <typename T>
-  ushort4 operator*(T v) {
-    return {x * v, y * v, z * v, w * v};
-  }
-  template <typename T>
-  ushort4 operator/(T v) {
-    return {x / v, y / v, z / v, w / v};
-  }
-};
-
-struct float4 {
-  float4() = default;
-  float4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
-  float x, y, z, w;
-  template <typename T>
-  float operator+(T v) {
-    return {x + v, y + v, z * v, w * v};
-  }
-  template <typename T>
-  float operator-(T v) {
-    return {x - v, y - v, z - v, w - v};
-  }
-  template <typename T>
-  float operator*(T v) {
-    return {x * v, y * v, z * v, w * v};
-  }
-  template <typename T>
-  float operator/(T v) {
-    return {x / v, y / v, z / v, w / v};
-  }
-};
-
-template <typename T>
-inline void resizeNN(const T* src, T* dst, int sw, int sh, int dw, int dh) {
-  for (int y = 0; y < dh; ++y) {
-    for (int x = 0; x < dw; ++x) {
-      int sy = (int)((float)y / dh * sh);
-      int sx = (int)((float)x / dw * sw);
-      dst[y * dw + x] = src[sy * sw + sx];
-    }
-  }
-}
-
-template <typename T>
-inline void resizeBilinear(
-    const T* src, T* dst, int sw, int sh, int dw, int dh) {
-  for (int y = 0; y < dh; ++y) {
-    for (int x = 0; x < dw; ++x) {
-      float fy = (float)y / dh * sh;
-      float fx = (float)x / dw * sw;
-      int gy = (int)fy;
-      int gx = (int)fx;
-
-      const auto p = [src, sw, sh](int x, int y) {
-        x = std::min(sw - 1, x);
-        y = std::min(sh - 1, y);
-        return src[y * sw + x];
-      };
-
-      T c00 = p(gx, gy);
-      T c10 = p(gx + 1, gy);
-      T c01 = p(gx, gy + 1);
-      T c11 = p(gx + 1, gy + 1);
-
-      const auto lerp = [](const T& s, const T& e, float t) {
-        return s + (e - s) * t;
-      };
-      T ret = lerp(lerp(c00, c10, gx), lerp(c01, c11, gx), gy);
-
-      dst[y * dw + x] = ret;
-    }
-  }
+inline size_t getPitch(PixelFormat format, int width) {
+  return getPixelFormatSize(format) * width;
 }
 
 bool Image::IsSupported(const std::string& ext) {
@@ -147,12 +37,13 @@ const std::vector<std::string>& Image::GetAllSupportedExtensions() {
   return exts;
 }
 
-std::unique_ptr<Image> Image::Load(const std::string& path, int pos) {
+std::unique_ptr<Image> Image::Load(const std::string& path, int pos,
+    int prefer_width, int prefer_height) {
   std::unique_ptr<ImageRW> reader = CreateImageRW(path);
   if (!reader) {
     return nullptr;
   }
-  return reader->Read(path);
+  return reader->Read(path, pos, prefer_width, prefer_height);
 }
 
 std::vector<uint8_t> Image::Save(
@@ -165,80 +56,228 @@ std::vector<uint8_t> Image::Save(
   return data;
 }
 
-Image::Image() {}
+constexpr const char* kMipQueueId = "mipmaps";
+
+// Deepest mip level of a |width| x |height| image at least |need_width| x
+// |need_height|, with some slack for scales computed in floats.
+int mipLevelFor(int width, int height, double need_width, double need_height) {
+  int level = 0;
+  while (width > 1 || height > 1) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    if (width + 1e-3 < need_width || height + 1e-3 < need_height) {
+      break;
+    }
+    ++level;
+  }
+  return level;
+}
+
+int decodeLevelFor(int width, int height, int prefer_width, int prefer_height) {
+  if (prefer_width <= 0 && prefer_height <= 0) {
+    return 0;
+  }
+  return mipLevelFor(width, height, prefer_width, prefer_height);
+}
+
+// Levels from 1, built in order. Dimensions fit in an int, so 32 levels do.
+struct Image::Mips {
+  std::mutex mutex;
+  std::unique_ptr<Image> levels[32];
+  // Deepest level built, published once its pixels are written.
+  std::atomic<int> built{0};
+};
+
+inline std::shared_ptr<const uint8_t> share(std::vector<uint8_t>&& data) {
+  auto owned = std::make_shared<std::vector<uint8_t>>(std::move(data));
+  return std::shared_ptr<const uint8_t>(owned, owned->data());
+}
+
+Image::Image()
+    : alpha_(AlphaMode::Straight),
+      size_(0),
+      owned_(true),
+      mips_(std::make_shared<Mips>()) {}
+
+Image::Image(int width, int height, size_t stride, PixelFormat format,
+    int channels, ColorSpace cs, data_t&& data, AlphaMode alpha)
+    : width_(width),
+      height_(height),
+      stride_(stride),
+      format_(format),
+      channels_(channels),
+      cs_(cs),
+      alpha_(alpha),
+      size_(data.size()),
+      owned_(true),
+      mips_(std::make_shared<Mips>()) {
+  data_ = share(std::move(data));
+}
 
 Image::Image(int width, int height, size_t stride, PixelFormat format,
-    int channels, ColorSpace cs, data_t&& data)
+    int channels, ColorSpace cs, std::shared_ptr<const uint8_t> data,
+    size_t size, AlphaMode alpha)
     : width_(width),
       height_(height),
       stride_(stride),
       format_(format),
       channels_(channels),
       cs_(cs),
-      data_(std::make_shared<data_t>(std::move(data))){}
+      alpha_(alpha),
+      data_(std::move(data)),
+      size_(size),
+      owned_(false),
+      mips_(std::make_shared<Mips>()) {}
 
 std::unique_ptr<Image> Image::Clone() const {
   return std::unique_ptr<Image>(new Image(*this));
 }
 
-std::unique_ptr<Image> Image::Convert(PixelFormat target) const {
-  // TODO:
-  assert(false && "not implemented.");
-  return {};
+std::unique_ptr<Image> Image::Convert(PixelFormat format) const {
+  return Convert(format, cs_, alpha_);
 }
 
-bool Image::Extract(int x, int y, Color& color) const {
-  if (x < 0 || x >= width()) return false;
-  if (y < 0 || y >= height()) return false;
+std::unique_ptr<Image> Image::Convert(
+    PixelFormat format, ColorSpace cs, AlphaMode alpha) const {
+  const size_t stride = getPitch(format, width_);
+  data_t buf(stride * height_);
+  convertPixels({format_, cs_, alpha_}, data(), stride_, {format, cs, alpha},
+      buf.data(), stride, width_, height_);
+  return std::unique_ptr<Image>(new Image(
+      width_, height_, stride, format, channels_, cs, std::move(buf), alpha));
+}
 
-  if (format_ == PixelFormat::RGBA8) {
-    const uchar4& rgba = *((uchar4*)data() + y * width_ + x);
-    color = Color(rgba.x, rgba.y, rgba.z, rgba.w);
-  } else if (format_ == PixelFormat::RGBA16) {
-    const ushort4& rgba = *((ushort4*)data() + y * width_ + x);
-    color = Color(rgba.x / 65535.0f, rgba.y / 65535.0f, rgba.z / 65535.0f,
-        rgba.w / 65535.0f);
-  } else if (format_ == PixelFormat::RGBA32F) {
-    const float4& rgba = *((float4*)data() + y * width_ + x);
-    color = Color(rgba.x, rgba.y, rgba.z, rgba.w);
-  } else {
-    assert(false && "format not implemented.");
-    return false;
+void Image::ConvertInPlace(
+    PixelFormat format, ColorSpace cs, AlphaMode alpha) {
+  if (getPixelFormatSize(format) != getPixelFormatSize(format_)) {
+    throw std::invalid_argument("pixel sizes differ.");
   }
+  // Nobody else may see the pixels change.
+  if (!owned_ || data_.use_count() > 1) {
+    *this = *Convert(format, cs, alpha);
+    return;
+  }
+  uint8_t* pixels = const_cast<uint8_t*>(data_.get());
+  convertPixels({format_, cs_, alpha_}, pixels, stride_, {format, cs, alpha},
+      pixels, stride_, width_, height_);
+  format_ = format;
+  cs_ = cs;
+  alpha_ = alpha;
+  mips_ = std::make_shared<Mips>();
+}
 
+bool Image::Extract(int x, int y, Color& color) const {
+  if (x < 0 || x >= width()) return false;
+  if (y < 0 || y >= height()) return false;
+  if (format_ == PixelFormat::Unknown) return false;
+
+  float rgba[4];
+  convertPixels({format_, cs_, alpha_},
+      data() + y * stride_ + x * getPixelFormatSize(format_), stride_,
+      {PixelFormat::RGBA32F, cs_, alpha_}, reinterpret_cast<uint8_t*>(rgba),
+      sizeof(rgba), 1, 1);
+  color = Color(rgba[0], rgba[1], rgba[2], rgba[3]);
   return true;
 }
 
-std::unique_ptr<Image> Image::Resize(
-    int dst_width, int dst_height, ResizeFilter filter) const {
-  data_t buf(getPitch(format_, dst_width) * dst_height);
-
-  size_t dst_stride = 0;
-  if (format_ == PixelFormat::RGBA8) {
-    resizeNN<uchar4>(reinterpret_cast<const uchar4*>(data()),
-        reinterpret_cast<uchar4*>(buf.data()), width_, height_, dst_width,
-        dst_height);
-    dst_stride = dst_width * sizeof(uchar4);
-  } else if (format_ == PixelFormat::RGBA16) {
-    resizeNN<ushort4>(reinterpret_cast<const ushort4*>(data()),
-        reinterpret_cast<ushort4*>(buf.data()), width_, height_, dst_width,
-        dst_height);
-    dst_stride = dst_width * sizeof(ushort4);
-  } else if (format_ == PixelFormat::RGBA32F) {
-    resizeNN<float4>(reinterpret_cast<const float4*>(data()),
-        reinterpret_cast<float4*>(buf.data()), width_, height_, dst_width,
-        dst_height);
-    dst_stride = dst_width * sizeof(float4);
+std::unique_ptr<Image> Image::Resize(int dst_width, int dst_height,
+    ResizeFilter filter, bool linear_light) const {
+  // Levels are never built here, a one-off resize would pay for and keep the
+  // whole pyramid. They are averaged in sRGB, which linear light is meant to
+  // avoid.
+  linear_light = linear_light && cs_ == ColorSpace::sRGB &&
+                 filter != ResizeFilter::Nearest &&
+                 filter != ResizeFilter::Bilinear;
+  const Image* src = this;
+  if (filter != ResizeFilter::Nearest && !linear_light) {
+    src = Mip(std::min(mipLevelFor(width_, height_, dst_width, dst_height),
+        mips_->built.load(std::memory_order_acquire)));
+  }
+  // Half floats are filtered as floats.
+  if (format_ == PixelFormat::RGBA16F && filter != ResizeFilter::Nearest) {
+    return src->Convert(PixelFormat::RGBA32F)
+        ->Resize(dst_width, dst_height, filter, linear_light)
+        ->Convert(PixelFormat::RGBA16F);
+  }
+  const size_t dst_stride = getPitch(format_, dst_width);
+  data_t buf(dst_stride * dst_height);
+  if (filter == ResizeFilter::Nearest) {
+    resizeNearest(format_, src->data(), src->width_, src->height_,
+        src->stride_, buf.data(), dst_width, dst_height, dst_stride);
+  } else if (filter == ResizeFilter::Bilinear) {
+    resizeBilinear(format_, src->data(), src->width_, src->height_,
+        src->stride_, buf.data(), dst_width, dst_height, dst_stride);
+  } else {
+    resizeSeparable(format_, src->data(), src->width_, src->height_,
+        src->stride_, buf.data(), dst_width, dst_height, dst_stride, filter,
+        linear_light);
   }
 
   std::unique_ptr<Image> dst = Clone();
   dst->width_ = dst_width;
   dst->height_ = dst_height;
   dst->stride_ = dst_stride;
-  dst->data_ = std::make_shared<data_t>(std::move(buf));
+  dst->size_ = buf.size();
+  dst->data_ = share(std::move(buf));
+  dst->owned_ = true;
+  dst->mips_ = std::make_shared<Mips>();
   return dst;
 }
 
+int Image::mip_levels() const noexcept {
+  return mipLevelFor(width_, height_, 0.0, 0.0) + 1;
+}
+
+int Image::level_for_scale(float scale) const noexcept {
+  return mipLevelFor(
+      width_, height_, (double)width_ * scale, (double)height_ * scale);
+}
+
+const Image* Image::Mip(int level) const {
+  level = std::min(level, mip_levels() - 1);
+  if (level <= 0) {
+    return this;
+  }
+  Mips& mips = *mips_;
+  if (level <= mips.built.load(std::memory_order_acquire)) {
+    return mips.levels[level - 1].get();
+  }
+
+  std::lock_guard lock(mips.mutex);
+  for (int i = mips.built.load(std::memory_order_relaxed) + 1; i <= level;
+       ++i) {
+    const Image* src = i == 1 ? this : mips.levels[i - 2].get();
+    // Half floats are filtered as floats.
+    std::unique_ptr<Image> floats;
+    if (format_ == PixelFormat::RGBA16F) {
+      floats = src->Convert(PixelFormat::RGBA32F);
+      src = floats.get();
+    }
+    const int width = (src->width_ + 1) / 2;
+    const int height = (src->height_ + 1) / 2;
+    const size_t stride = getPitch(src->format_, width);
+    data_t buf(stride * height);
+    resizeHalf(src->format_, src->data(), src->width_, src->height_,
+        src->stride_, buf.data(), stride);
+    auto mip = std::make_unique<Image>(
+        width, height, stride, src->format_, channels_, cs_, std::move(buf));
+    mip->alpha_ = alpha_;
+    mips.levels[i - 1] = floats ? mip->Convert(format_) : std::move(mip);
+    mips.built.store(i, std::memory_order_release);
+  }
+  return mips.levels[level - 1].get();
+}
+
+void Image::GenerateMips() const {
+  // The clone keeps the pixels and the levels alive until done.
+  std::shared_ptr<const Image> self = Clone();
+  task::dispatchAsync(kMipQueueId, [self](std::atomic<bool>& cancelled) {
+    for (int i = 1; i < self->mip_levels() && !cancelled; ++i) {
+      self->Mip(i);
+    }
+  });
+}
+
 Image::~Image() {}
 
 std::unique_ptr<ImageRW> CreateImageRW(const std::string& path) {
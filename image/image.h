@@ -20,16 +20,32 @@
 
 namespace chaos {
 
-enum class ResizeFilter { Nearest = 0, Bilinear = 1};
+// Box, Mitchell and Lanczos3 are separable filters widened on reductions,
+// Box then averages the covered area.
+enum class ResizeFilter {
+  Nearest = 0,
+  Bilinear = 1,
+  Box = 2,
+  Mitchell = 3,
+  Lanczos3 = 4,
+};
 
 class Image;
 class ImageRW;
 
 std::unique_ptr<ImageRW> CreateImageRW(const std::string& url);
 
+// Times a |width| x |height| image can be halved, rounding up, and still be
+// at least |prefer_width| x |prefer_height|. A zero preference leaves that
+// dimension free, both zero keep the full size.
+int decodeLevelFor(int width, int height, int prefer_width, int prefer_height);
+
 class ImageRW {
  public:
   virtual ~ImageRW();
+  // Decodes frame |pos| reduced as far as decodeLevelFor() allows, at that
+  // scale where the codec can and halved after otherwise. |header_only|
+  // returns the stored size without pixels.
   virtual std::unique_ptr<Image> Read(const std::string& path, int pos = 0,
       int prefer_width = 0, int prefer_height = 0, bool header_only = false) {
     throw std::domain_error("not implemented.");
@@ -49,13 +65,21 @@ class Image {
  public:
   static bool IsSupported(const std::string& ext);
   static const std::vector<std::string>& GetAllSupportedExtensions();
-  static std::unique_ptr<Image> Load(const std::string& path, int pos = 0);
+  // See ImageRW::Read() for the preferred size.
+  static std::unique_ptr<Image> Load(const std::string& path, int pos = 0,
+      int prefer_width = 0, int prefer_height = 0);
   static std::vector<uint8_t> Save(const Image* image, const std::string& format);
 
   Image(const Image&) = default;
   Image& operator=(const Image&) = default;
   Image(int width, int height, size_t stride, PixelFormat format, int channels,
-      ColorSpace cs, data_t&& data = {});
+      ColorSpace cs, data_t&& data = {},
+      AlphaMode alpha = AlphaMode::Straight);
+  // Zero-copy view of |size| bytes at |data|, e.g. a file mapping, which
+  // |data| keeps alive.
+  Image(int width, int height, size_t stride, PixelFormat format, int channels,
+      ColorSpace cs, std::shared_ptr<const uint8_t> data, size_t size,
+      AlphaMode alpha = AlphaMode::Straight);
   ~Image();
 
   int width() const noexcept { return width_; }
@@ -64,23 +88,55 @@ class Image {
   PixelFormat format() const noexcept { return format_; }
   int channels() const noexcept { return channels_; }
   ColorSpace colorspace() const noexcept { return cs_; }
-  const uint8_t* data() const noexcept { return data_->data(); };
-  const std::vector<uint8_t>& data_vec() const noexcept { return *data_; }
-  size_t size() const noexcept { return data_->size(); }
+  AlphaMode alpha_mode() const noexcept { return alpha_; }
+  const uint8_t* data() const noexcept { return data_.get(); };
+  size_t size() const noexcept { return size_; }
 
   std::unique_ptr<Image> Clone() const;
-  std::unique_ptr<Image> Convert(PixelFormat target) const;
+  // Copy in |format|, keeping the color space and alpha mode.
+  std::unique_ptr<Image> Convert(PixelFormat format) const;
+  // Also moves the colors between sRGB and linear and in or out of
+  // premultiplied alpha.
+  std::unique_ptr<Image> Convert(
+      PixelFormat format, ColorSpace cs, AlphaMode alpha) const;
+  // As Convert() to a format of the same pixel size, overwriting the pixels
+  // unless they are a view or shared with another image.
+  void ConvertInPlace(PixelFormat format, ColorSpace cs, AlphaMode alpha);
   bool Extract(int x, int y, Color& color) const;
-  std::unique_ptr<Image> Resize(int width, int height, ResizeFilter filter) const;
+  // |linear_light| filters sRGB images in linear light, which keeps bright
+  // details from darkening. Only the separable filters support it.
+  // Filtered reductions start from the smallest mip level still as large as
+  // the result among those already built, see Mip() and GenerateMips().
+  // Nearest and linear light reductions always sample this image.
+  std::unique_ptr<Image> Resize(int width, int height, ResizeFilter filter,
+      bool linear_light = false) const;
+
+  // Mip levels halve the size down to 1x1 with a 2x2 box, level 0 being this
+  // image. They are built on first use and shared with clones.
+  int mip_levels() const noexcept;
+  // Deepest level still at least |scale| times the size.
+  int level_for_scale(float scale) const noexcept;
+  // Builds |level| and those above it unless already done, the result lives
+  // as long as this image.
+  const Image* Mip(int level) const;
+  // Builds all levels on a background queue.
+  void GenerateMips() const;
 
  private:
+  struct Mips;
+
   int width_;
   int height_;
   size_t stride_;
   PixelFormat format_;
   int channels_;
   ColorSpace cs_;
-  std::shared_ptr<data_t> data_;
+  AlphaMode alpha_;
+  // Points into an owned buffer or a view's memory.
+  std::shared_ptr<const uint8_t> data_;
+  size_t size_;
+  bool owned_;
+  std::shared_ptr<Mips> mips_;
 };
 
 }  // namespace chaos
@@ -2,6 +2,7 @@
 #include "image.h"
 
 #include "base/fs.h"
+#include "base/task.h"
 #include "base/text.h"
 
 #include <bitset>
@@ -10,6 +11,7 @@
 #include <iosfwd>
 
 #include "pnm.hpp"
+#include "resize.h"
 
 namespace chaos {
 
@@ -77,50 +79,48 @@ std::unique_ptr<Image> PnmRW::Read(const std::string& path, int pos,
   }
 
   std::vector<uint8_t> buffer(w * 4 * h);
+
   const uint8_t* src = data.data();
   uint32_t* dst = (uint32_t*)buffer.data();
-
-  if (depth == 8) {
-    if (ch == 1) {
-      for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-          uint8_t v = src[y * w + x];
-          dst[y * w + x] = 255 | v << 16 | v << 8 | v;
-        }
-      }
-    } else {
-      for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-          uint8_t r = src[y * w * 3 + x * 3 + 0];
-          uint8_t g = src[y * w * 3 + x * 3 + 1];
-          uint8_t b = src[y * w * 3 + x * 3 + 2];
-          dst[y * w + x] = 255 | b << 16 | g << 8 | r;
-        }
-      }
-    }
-  } else if (depth == 1) {
-    const uint8_t* src = data.data();
-    uint32_t* dst = (uint32_t*)buffer.data();
-    if (ch == 1) {
-      for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-          uint8_t v = src[y * w + x] * 255 / value_max;
-          dst[y * w + x] = 255 << 24 | v << 16 | v << 8 | v;
+  task::parallel_for(0, h, [&](size_t y0, size_t y1) {
+    for (int y = (int)y0; y < (int)y1; ++y) {
+      if (depth == 8) {
+        if (ch == 1) {
+          for (int x = 0; x < w; ++x) {
+            uint8_t v = src[y * w + x];
+            dst[y * w + x] = 255 | v << 16 | v << 8 | v;
+          }
+        } else {
+          for (int x = 0; x < w; ++x) {
+            uint8_t r = src[y * w * 3 + x * 3 + 0];
+            uint8_t g = src[y * w * 3 + x * 3 + 1];
+            uint8_t b = src[y * w * 3 + x * 3 + 2];
+            dst[y * w + x] = 255 | b << 16 | g << 8 | r;
+          }
         }
-      }
-    } else {
-      for (int y = 0; y < h; ++y) {
-        for (int x = 0; x < w; ++x) {
-          uint8_t r = src[y * w * 3 + x * 3 + 0] * 255 / value_max;
-          uint8_t g = src[y * w * 3 + x * 3 + 1] * 255 / value_max;
-          uint8_t b = src[y * w * 3 + x * 3 + 2] * 255 / value_max;
-          dst[y * w + x] = 255 << 24 | b << 16 | g << 8 | r;
+      } else {
+        if (ch == 1) {
+          for (int x = 0; x < w; ++x) {
+            uint8_t v = src[y * w + x] * 255 / value_max;
+            dst[y * w + x] = 255 << 24 | v << 16 | v << 8 | v;
+          }
+        } else {
+          for (int x = 0; x < w; ++x) {
+            uint8_t r = src[y * w * 3 + x * 3 + 0] * 255 / value_max;
+            uint8_t g = src[y * w * 3 + x * 3 + 1] * 255 / value_max;
+            uint8_t b = src[y * w * 3 + x * 3 + 2] * 255 / value_max;
+            dst[y * w + x] = 255 << 24 | b << 16 | g << 8 | r;
+          }
         }
       }
     }
-  } else {
-    assert(false && "unexpected bit depth.");
-    return nullptr;
+  });
+
+  // pnm.hpp loads whole files, halve once expanded.
+  const int level = decodeLevelFor(w, h, prefer_width, prefer_height);
+  if (level > 0) {
+    buffer = resizeHalves(
+        PixelFormat::RGBA8, buffer.data(), w, h, (size_t)w * 4, level);
   }
 
   std::unique_ptr<Image> image(
@@ -0,0 +1,1090 @@
+#include "resize.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+
+#include "base/task.h"
+
+#include "convert.h"
+
+namespace chaos {
+
+namespace {
+
+// Pixels per parallel_for() chunk, smaller images run on fewer threads.
+constexpr size_t kPixelsPerChunk = 32 * 1024;
+
+std::atomic<int> g_simd_cap{INT_MAX};
+
+SimdLevel detectSimdLevel() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int max_leaf = info[0];
+  __cpuid(info, 1);
+  const bool sse41 = info[2] & (1 << 19);
+  const bool f16c = info[2] & (1 << 29);
+  // AVX registers must be saved by the OS as well.
+  const bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                   (_xgetbv(0) & 0x6) == 0x6;
+  bool avx2 = false;
+  if (avx && max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    avx2 = info[1] & (1 << 5);
+  }
+#else
+  __builtin_cpu_init();
+  const bool sse41 = __builtin_cpu_supports("sse4.1");
+  const bool f16c = __builtin_cpu_supports("f16c");
+  const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+  // Half float conversions come with the AVX2 level.
+  if (sse41 && avx2 && f16c) {
+    return SimdLevel::AVX2;
+  }
+  return sse41 ? SimdLevel::SSE41 : SimdLevel::Scalar;
+}
+
+// Source position of every destination column or row, computed once per
+// resize instead of per pixel.
+struct Taps {
+  std::vector<int> i0;
+  std::vector<int> i1;
+  // Weight of i1.
+  std::vector<float> w;
+};
+
+Taps nearestTaps(int src, int dst) {
+  Taps taps;
+  taps.i0.resize(dst);
+  for (int i = 0; i < dst; ++i) {
+    const int64_t s = ((2 * (int64_t)i + 1) * src) / (2 * (int64_t)dst);
+    taps.i0[i] = (int)std::min<int64_t>(s, src - 1);
+  }
+  return taps;
+}
+
+Taps bilinearTaps(int src, int dst) {
+  Taps taps;
+  taps.i0.resize(dst);
+  taps.i1.resize(dst);
+  taps.w.resize(dst);
+  const double scale = (double)src / dst;
+  for (int i = 0; i < dst; ++i) {
+    const double f = std::clamp((i + 0.5) * scale - 0.5, 0.0, src - 1.0);
+    const int i0 = std::min((int)f, src - 1);
+    taps.i0[i] = i0;
+    taps.i1[i] = std::min(i0 + 1, src - 1);
+    taps.w[i] = (float)(f - i0);
+  }
+  return taps;
+}
+
+// Pairs of columns or rows a 2x2 box averages.
+Taps halfTaps(int src) {
+  Taps taps;
+  const int dst = (src + 1) / 2;
+  taps.i0.resize(dst);
+  taps.i1.resize(dst);
+  for (int i = 0; i < dst; ++i) {
+    taps.i0[i] = 2 * i;
+    taps.i1[i] = std::min(2 * i + 1, src - 1);
+  }
+  return taps;
+}
+
+struct Job {
+  const uint8_t* src;
+  size_t src_stride;
+  uint8_t* dst;
+  size_t dst_stride;
+  int dst_width;
+  int dst_height;
+  Taps xs;
+  Taps ys;
+};
+
+template <PixelFormat F>
+constexpr size_t kPixelSize = F == PixelFormat::RGBA32F ? 16
+                              : F == PixelFormat::RGBA16 ? 8
+                                                         : 4;
+
+// Scalar
+
+template <PixelFormat F>
+inline void loadPixel(const uint8_t* p, float* out) {
+  if constexpr (F == PixelFormat::RGBA32F) {
+    ::memcpy(out, p, 16);
+  } else if constexpr (F == PixelFormat::RGBA16) {
+    uint16_t v[4];
+    ::memcpy(v, p, 8);
+    for (int c = 0; c < 4; ++c) {
+      out[c] = v[c];
+    }
+  } else {
+    for (int c = 0; c < 4; ++c) {
+      out[c] = p[c];
+    }
+  }
+}
+
+// Rounds half to even like the SIMD conversions.
+template <PixelFormat F>
+inline void storePixel(const float* in, uint8_t* p) {
+  if constexpr (F == PixelFormat::RGBA32F) {
+    ::memcpy(p, in, 16);
+  } else if constexpr (F == PixelFormat::RGBA16) {
+    uint16_t v[4];
+    for (int c = 0; c < 4; ++c) {
+      v[c] = (uint16_t)std::clamp(std::nearbyint(in[c]), 0.0f, 65535.0f);
+    }
+    ::memcpy(p, v, 8);
+  } else {
+    for (int c = 0; c < 4; ++c) {
+      p[c] = (uint8_t)std::clamp(std::nearbyint(in[c]), 0.0f, 255.0f);
+    }
+  }
+}
+
+template <PixelFormat F>
+void horizontalScalar(
+    const uint8_t* src, const Taps& xs, float* out, int width) {
+  for (int x = 0; x < width; ++x) {
+    float p0[4], p1[4];
+    loadPixel<F>(src + xs.i0[x] * kPixelSize<F>, p0);
+    loadPixel<F>(src + xs.i1[x] * kPixelSize<F>, p1);
+    for (int c = 0; c < 4; ++c) {
+      out[x * 4 + c] = p0[c] + (p1[c] - p0[c]) * xs.w[x];
+    }
+  }
+}
+
+template <PixelFormat F>
+void verticalScalar(
+    const float* a, const float* b, float w, uint8_t* dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    float p[4];
+    for (int c = 0; c < 4; ++c) {
+      p[c] = a[x * 4 + c] + (b[x * 4 + c] - a[x * 4 + c]) * w;
+    }
+    storePixel<F>(p, dst + x * kPixelSize<F>);
+  }
+}
+
+template <size_t kSize>
+void nearestScalar(
+    const uint8_t* src, const Taps& xs, uint8_t* dst, int width) {
+  for (int x = 0; x < width; ++x) {
+    ::memcpy(dst + x * kSize, src + xs.i0[x] * kSize, kSize);
+  }
+}
+
+// Averages rows |a| and |b| over the column pairs of |xs|.
+template <PixelFormat F>
+void halveScalar(const uint8_t* a, const uint8_t* b, const Taps& xs,
+    uint8_t* dst, int first, int width) {
+  constexpr size_t kSize = kPixelSize<F>;
+  for (int x = first; x < width; ++x) {
+    const uint8_t* p[4] = {a + xs.i0[x] * kSize, a + xs.i1[x] * kSize,
+        b + xs.i0[x] * kSize, b + xs.i1[x] * kSize};
+    if constexpr (F == PixelFormat::RGBA32F) {
+      float sum[4] = {};
+      for (const uint8_t* q : p) {
+        float v[4];
+        ::memcpy(v, q, 16);
+        for (int c = 0; c < 4; ++c) {
+          sum[c] += v[c];
+        }
+      }
+      for (float& v : sum) {
+        v *= 0.25f;
+      }
+      ::memcpy(dst + x * kSize, sum, 16);
+    } else {
+      using code_t =
+          std::conditional_t<F == PixelFormat::RGBA16, uint16_t, uint8_t>;
+      int sum[4] = {2, 2, 2, 2};
+      for (const uint8_t* q : p) {
+        code_t v[4];
+        ::memcpy(v, q, kSize);
+        for (int c = 0; c < 4; ++c) {
+          sum[c] += v[c];
+        }
+      }
+      code_t out[4];
+      for (int c = 0; c < 4; ++c) {
+        out[c] = (code_t)(sum[c] >> 2);
+      }
+      ::memcpy(dst + x * kSize, out, kSize);
+    }
+  }
+}
+
+// SSE4.1, a pixel per register.
+
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+inline __m128 loadPixelSse(const uint8_t* p) {
+  if constexpr (F == PixelFormat::RGBA32F) {
+    return _mm_loadu_ps(reinterpret_cast<const float*>(p));
+  } else if constexpr (F == PixelFormat::RGBA16) {
+    const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(v));
+  } else {
+    int v;
+    ::memcpy(&v, p, 4);
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+  }
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+inline void storePixelSse(__m128 v, uint8_t* p) {
+  if constexpr (F == PixelFormat::RGBA32F) {
+    _mm_storeu_ps(reinterpret_cast<float*>(p), v);
+  } else {
+    __m128i i = _mm_cvtps_epi32(v);
+    i = _mm_packus_epi32(i, i);
+    if constexpr (F == PixelFormat::RGBA16) {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(p), i);
+    } else {
+      const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+      ::memcpy(p, &packed, 4);
+    }
+  }
+}
+
+// Column |x| of a horizontally resampled row.
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+inline __m128 tapSse(const uint8_t* src, const Taps& xs, int x) {
+  const __m128 p0 = loadPixelSse<F>(src + xs.i0[x] * kPixelSize<F>);
+  const __m128 p1 = loadPixelSse<F>(src + xs.i1[x] * kPixelSize<F>);
+  return _mm_add_ps(p0, _mm_mul_ps(_mm_sub_ps(p1, p0), _mm_set1_ps(xs.w[x])));
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+void horizontalSse(const uint8_t* src, const Taps& xs, float* out, int width) {
+  for (int x = 0; x < width; ++x) {
+    _mm_storeu_ps(out + x * 4, tapSse<F>(src, xs, x));
+  }
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+void verticalSse(const float* a, const float* b, float w, uint8_t* dst,
+    int first, int width) {
+  const __m128 wv = _mm_set1_ps(w);
+  for (int x = first; x < width; ++x) {
+    const __m128 va = _mm_loadu_ps(a + x * 4);
+    const __m128 vb = _mm_loadu_ps(b + x * 4);
+    storePixelSse<F>(_mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), wv)),
+        dst + x * kPixelSize<F>);
+  }
+}
+
+// Output pixels |first| to |width| whose columns are both inside the rows.
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+void halveSse(const uint8_t* a, const uint8_t* b, uint8_t* dst, int first,
+    int width) {
+  for (int x = first; x < width; ++x) {
+    const uint8_t* pa = a + x * 2 * kPixelSize<F>;
+    const uint8_t* pb = b + x * 2 * kPixelSize<F>;
+    if constexpr (F == PixelFormat::RGBA32F) {
+      const float* fa = reinterpret_cast<const float*>(pa);
+      const float* fb = reinterpret_cast<const float*>(pb);
+      const __m128 sum =
+          _mm_add_ps(_mm_add_ps(_mm_loadu_ps(fa), _mm_loadu_ps(fa + 4)),
+              _mm_add_ps(_mm_loadu_ps(fb), _mm_loadu_ps(fb + 4)));
+      _mm_storeu_ps(reinterpret_cast<float*>(dst) + x * 4,
+          _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+    } else if constexpr (F == PixelFormat::RGBA16) {
+      const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa));
+      const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb));
+      __m128i sum = _mm_add_epi32(
+          _mm_add_epi32(_mm_cvtepu16_epi32(va),
+              _mm_cvtepu16_epi32(_mm_srli_si128(va, 8))),
+          _mm_add_epi32(_mm_cvtepu16_epi32(vb),
+              _mm_cvtepu16_epi32(_mm_srli_si128(vb, 8))));
+      sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 8),
+          _mm_packus_epi32(sum, sum));
+    } else {
+      __m128i sum = _mm_add_epi16(
+          _mm_cvtepu8_epi16(
+              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pa))),
+          _mm_cvtepu8_epi16(
+              _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pb))));
+      // Left pixel plus right one.
+      sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+      const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+      ::memcpy(dst + x * 4, &packed, 4);
+    }
+  }
+}
+
+// AVX2, two pixels per register.
+
+template <PixelFormat F>
+CHAOS_TARGET("avx2")
+void horizontalAvx2(const uint8_t* src, const Taps& xs, float* out, int width) {
+  constexpr size_t kSize = kPixelSize<F>;
+  int x = 0;
+  for (; x + 2 <= width; x += 2) {
+    const uint8_t* lo = src + xs.i0[x] * kSize;
+    const uint8_t* hi = src + xs.i0[x + 1] * kSize;
+    const __m256 p0 =
+        _mm256_set_m128(loadPixelSse<F>(hi), loadPixelSse<F>(lo));
+    lo = src + xs.i1[x] * kSize;
+    hi = src + xs.i1[x + 1] * kSize;
+    const __m256 p1 =
+        _mm256_set_m128(loadPixelSse<F>(hi), loadPixelSse<F>(lo));
+    const __m256 w =
+        _mm256_set_m128(_mm_set1_ps(xs.w[x + 1]), _mm_set1_ps(xs.w[x]));
+    _mm256_storeu_ps(out + x * 4,
+        _mm256_add_ps(p0, _mm256_mul_ps(_mm256_sub_ps(p1, p0), w)));
+  }
+  for (; x < width; ++x) {
+    _mm_storeu_ps(out + x * 4, tapSse<F>(src, xs, x));
+  }
+}
+
+CHAOS_TARGET("avx2")
+inline __m256 lerpAvx2(const float* a, const float* b, __m256 w) {
+  const __m256 va = _mm256_loadu_ps(a);
+  const __m256 vb = _mm256_loadu_ps(b);
+  return _mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(vb, va), w));
+}
+
+// Four pixels, two in |lo| and two in |hi|.
+template <PixelFormat F>
+CHAOS_TARGET("avx2")
+inline void storePixelsAvx2(__m256 lo, __m256 hi, uint8_t* p) {
+  if constexpr (F == PixelFormat::RGBA32F) {
+    _mm256_storeu_ps(reinterpret_cast<float*>(p), lo);
+    _mm256_storeu_ps(reinterpret_cast<float*>(p) + 8, hi);
+  } else {
+    // Packing works per 128-bit lane, the permute restores pixel order.
+    __m256i v = _mm256_packus_epi32(
+        _mm256_cvtps_epi32(lo), _mm256_cvtps_epi32(hi));
+    v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+    if constexpr (F == PixelFormat::RGBA16) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+    } else {
+      const __m128i bytes = _mm_packus_epi16(
+          _mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(p), bytes);
+    }
+  }
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("avx2")
+void verticalAvx2(
+    const float* a, const float* b, float w, uint8_t* dst, int width) {
+  const __m256 wv = _mm256_set1_ps(w);
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    storePixelsAvx2<F>(lerpAvx2(a + x * 4, b + x * 4, wv),
+        lerpAvx2(a + x * 4 + 8, b + x * 4 + 8, wv), dst + x * kPixelSize<F>);
+  }
+  verticalSse<F>(a, b, w, dst, x, width);
+}
+
+template <size_t kSize>
+CHAOS_TARGET("avx2")
+void nearestAvx2(const uint8_t* src, const Taps& xs, uint8_t* dst, int width) {
+  int x = 0;
+  if constexpr (kSize == 4) {
+    for (; x + 8 <= width; x += 8) {
+      const __m256i index = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(xs.i0.data() + x));
+      const __m256i pixels = _mm256_i32gather_epi32(
+          reinterpret_cast<const int*>(src), index, 4);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), pixels);
+    }
+  } else if constexpr (kSize == 8) {
+    for (; x + 4 <= width; x += 4) {
+      const __m128i index = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(xs.i0.data() + x));
+      const __m256i pixels = _mm256_i32gather_epi64(
+          reinterpret_cast<const long long*>(src), index, 8);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 8), pixels);
+    }
+  }
+  for (; x < width; ++x) {
+    ::memcpy(dst + x * kSize, src + xs.i0[x] * kSize, kSize);
+  }
+}
+
+// Four 8-bit output pixels an iteration, other formats go as SSE4.1.
+template <PixelFormat F>
+CHAOS_TARGET("avx2")
+void halveAvx2(const uint8_t* a, const uint8_t* b, uint8_t* dst, int width) {
+  int x = 0;
+  if constexpr (F == PixelFormat::RGBA8) {
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5);
+    const auto load = [](const uint8_t* p) CHAOS_TARGET("avx2") {
+      return _mm256_cvtepu8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    };
+    for (; x + 4 <= width; x += 4) {
+      const uint8_t* pa = a + x * 8;
+      const uint8_t* pb = b + x * 8;
+      // Source pixels 0-1 | 2-3 and 4-5 | 6-7, summed over the rows.
+      const __m256i lo = _mm256_add_epi16(load(pa), load(pb));
+      const __m256i hi = _mm256_add_epi16(load(pa + 16), load(pb + 16));
+      // Outputs 0, 2 | 1, 3.
+      __m256i sum = _mm256_add_epi16(
+          _mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+      sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+      const __m256i bytes = _mm256_permutevar8x32_epi32(
+          _mm256_packus_epi16(sum, sum), order);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4),
+          _mm256_castsi256_si128(bytes));
+    }
+  }
+  halveSse<F>(a, b, dst, x, width);
+}
+
+// Row drivers
+
+template <size_t kSize>
+void nearestRows(const Job& job, size_t y0, size_t y1, SimdLevel level) {
+  const size_t row_size = job.dst_width * kSize;
+  for (size_t y = y0; y < y1; ++y) {
+    uint8_t* dst = job.dst + y * job.dst_stride;
+    const int sy = job.ys.i0[y];
+    // Enlarging repeats source rows.
+    if (y > y0 && job.ys.i0[y - 1] == sy) {
+      ::memcpy(dst, dst - job.dst_stride, row_size);
+      continue;
+    }
+    const uint8_t* src = job.src + sy * job.src_stride;
+    if (level == SimdLevel::AVX2) {
+      nearestAvx2<kSize>(src, job.xs, dst, job.dst_width);
+    } else {
+      nearestScalar<kSize>(src, job.xs, dst, job.dst_width);
+    }
+  }
+}
+
+template <PixelFormat F>
+void bilinearRows(const Job& job, size_t y0, size_t y1, SimdLevel level) {
+  const int width = job.dst_width;
+  // Horizontally resampled source rows, neighbouring output rows share them.
+  std::vector<float> rows[2] = {std::vector<float>(width * 4),
+      std::vector<float>(width * 4)};
+  int cached[2] = {-1, -1};
+  const auto row = [&](int sy) -> const float* {
+    for (int i = 0; i < 2; ++i) {
+      if (cached[i] == sy) {
+        return rows[i].data();
+      }
+    }
+    // Rows go down, the upper one is done with.
+    const int i = cached[0] < cached[1] ? 0 : 1;
+    const uint8_t* src = job.src + sy * job.src_stride;
+    if (level == SimdLevel::AVX2) {
+      horizontalAvx2<F>(src, job.xs, rows[i].data(), width);
+    } else if (level == SimdLevel::SSE41) {
+      horizontalSse<F>(src, job.xs, rows[i].data(), width);
+    } else {
+      horizontalScalar<F>(src, job.xs, rows[i].data(), width);
+    }
+    cached[i] = sy;
+    return rows[i].data();
+  };
+
+  for (size_t y = y0; y < y1; ++y) {
+    const float* a = row(job.ys.i0[y]);
+    const float* b = row(job.ys.i1[y]);
+    uint8_t* dst = job.dst + y * job.dst_stride;
+    if (level == SimdLevel::AVX2) {
+      verticalAvx2<F>(a, b, job.ys.w[y], dst, width);
+    } else if (level == SimdLevel::SSE41) {
+      verticalSse<F>(a, b, job.ys.w[y], dst, 0, width);
+    } else {
+      verticalScalar<F>(a, b, job.ys.w[y], dst, width);
+    }
+  }
+}
+
+// Separable filters
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Radius in source pixels before stretching.
+double filterSupport(ResizeFilter filter) {
+  switch (filter) {
+    case ResizeFilter::Mitchell:
+      return 2.0;
+    case ResizeFilter::Lanczos3:
+      return 3.0;
+    default:
+      return 0.5;
+  }
+}
+
+double filterKernel(ResizeFilter filter, double x) {
+  x = std::abs(x);
+  if (filter == ResizeFilter::Mitchell) {
+    // B = C = 1/3, the compromise between blur and ringing.
+    constexpr double B = 1.0 / 3.0;
+    constexpr double C = 1.0 / 3.0;
+    if (x < 1.0) {
+      return ((12 - 9 * B - 6 * C) * x * x * x +
+                 (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) /
+             6;
+    }
+    if (x < 2.0) {
+      return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+                 (-12 * B - 48 * C) * x + (8 * B + 24 * C)) /
+             6;
+    }
+    return 0.0;
+  }
+  // Lanczos3
+  if (x < 1e-8) {
+    return 1.0;
+  }
+  if (x >= 3.0) {
+    return 0.0;
+  }
+  const double px = kPi * x;
+  return 3.0 * std::sin(px) * std::sin(px / 3.0) / (px * px);
+}
+
+// Weights of every destination column or row over |taps| consecutive source
+// ones from |first|. Windows are shifted inside the image and zero padded, so
+// all have the same length and the loops need no bounds checks.
+struct Weights {
+  int taps = 0;
+  std::vector<int> first;
+  // |taps| per destination pixel.
+  std::vector<float> w;
+};
+
+Weights filterWeights(ResizeFilter filter, int src, int dst) {
+  const double scale = (double)src / dst;
+  // Reductions stretch the filter over all the source pixels it covers.
+  const double stretch = std::max(1.0, scale);
+  const double support = filterSupport(filter) * stretch;
+  const int span = std::min(src, (int)std::ceil(2.0 * support) + 3);
+
+  std::vector<double> raw((size_t)dst * span);
+  std::vector<int> lo(dst);
+  std::vector<int> count(dst);
+  Weights weights;
+  for (int i = 0; i < dst; ++i) {
+    const double center = (i + 0.5) * scale;
+    int j0 = std::max(0, (int)std::floor(center - support));
+    const int j1 = std::min(src - 1, (int)std::ceil(center + support));
+    double* w = raw.data() + (size_t)i * span;
+    int n = 0;
+    double sum = 0.0;
+    for (int j = j0; j <= j1 && n < span; ++j) {
+      double v;
+      if (filter == ResizeFilter::Box) {
+        // Area covered, exact for fractional reductions.
+        v = std::max(0.0, std::min(j + 1.0, center + support) -
+                              std::max((double)j, center - support));
+      } else {
+        v = filterKernel(filter, (j + 0.5 - center) / stretch);
+      }
+      // Leading zeros move the window instead.
+      if (n == 0 && v == 0.0) {
+        ++j0;
+        continue;
+      }
+      w[n++] = v;
+      sum += v;
+    }
+    while (n > 0 && w[n - 1] == 0.0) {
+      --n;
+    }
+    if (n == 0 || std::abs(sum) < 1e-12) {
+      j0 = std::clamp((int)center, 0, src - 1);
+      w[0] = 1.0;
+      n = 1;
+      sum = 1.0;
+    }
+    // Edges lose the taps outside the image, the rest keep the brightness.
+    for (int k = 0; k < n; ++k) {
+      w[k] /= sum;
+    }
+    lo[i] = j0;
+    count[i] = n;
+    weights.taps = std::max(weights.taps, n);
+  }
+
+  const int taps = weights.taps;
+  weights.first.resize(dst);
+  weights.w.assign((size_t)dst * taps, 0.0f);
+  for (int i = 0; i < dst; ++i) {
+    const int first = std::min(lo[i], src - taps);
+    weights.first[i] = first;
+    float* w = weights.w.data() + (size_t)i * taps + (lo[i] - first);
+    for (int k = 0; k < count[i]; ++k) {
+      w[k] = (float)raw[(size_t)i * span + k];
+    }
+  }
+  return weights;
+}
+
+template <PixelFormat F>
+constexpr float kMaxValue = F == PixelFormat::RGBA16 ? 65535.0f : 255.0f;
+
+// Linear values of every 8 or 16-bit code, in the scale of the codes.
+template <PixelFormat F>
+const std::vector<float>& decodeTable() {
+  static const std::vector<float> table = [] {
+    std::vector<float> t((size_t)kMaxValue<F> + 1);
+    for (size_t i = 0; i < t.size(); ++i) {
+      t[i] = srgbToLinear(i / kMaxValue<F>) * kMaxValue<F>;
+    }
+    return t;
+  }();
+  return table;
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+void loadRowSse(const uint8_t* src, float* out, int width) {
+  for (int x = 0; x < width; ++x) {
+    _mm_storeu_ps(out + x * 4, loadPixelSse<F>(src + x * kPixelSize<F>));
+  }
+}
+
+// Source row as floats, decoded to linear light when |linear|.
+template <PixelFormat F>
+void loadRow(const uint8_t* src, float* out, int width, bool linear,
+    SimdLevel level) {
+  if (!linear) {
+    if (level != SimdLevel::Scalar) {
+      loadRowSse<F>(src, out, width);
+    } else {
+      for (int x = 0; x < width; ++x) {
+        loadPixel<F>(src + x * kPixelSize<F>, out + x * 4);
+      }
+    }
+  } else if constexpr (F == PixelFormat::RGBA32F) {
+    ::memcpy(out, src, (size_t)width * 16);
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        out[x * 4 + c] = srgbToLinear(out[x * 4 + c]);
+      }
+    }
+  } else {
+    using code_t =
+        std::conditional_t<F == PixelFormat::RGBA16, uint16_t, uint8_t>;
+    const float* table = decodeTable<F>().data();
+    for (int x = 0; x < width; ++x) {
+      code_t v[4];
+      ::memcpy(v, src + x * kPixelSize<F>, sizeof(v));
+      out[x * 4 + 0] = table[v[0]];
+      out[x * 4 + 1] = table[v[1]];
+      out[x * 4 + 2] = table[v[2]];
+      out[x * 4 + 3] = v[3];
+    }
+  }
+}
+
+template <PixelFormat F>
+void encodeRow(float* row, int width) {
+  if constexpr (F == PixelFormat::RGBA32F) {
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        row[x * 4 + c] = linearToSrgb(row[x * 4 + c]);
+      }
+    }
+  } else {
+    // Ringing past the range clamps as the store would.
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        row[x * 4 + c] =
+            linearToSrgbFast(row[x * 4 + c] / kMaxValue<F>) * kMaxValue<F>;
+      }
+    }
+  }
+}
+
+void filterRowScalar(const float* row, const Weights& xs, float* out,
+    int width) {
+  for (int x = 0; x < width; ++x) {
+    const float* p = row + xs.first[x] * 4;
+    const float* w = xs.w.data() + (size_t)x * xs.taps;
+    float acc[4] = {};
+    for (int t = 0; t < xs.taps; ++t) {
+      for (int c = 0; c < 4; ++c) {
+        acc[c] += p[t * 4 + c] * w[t];
+      }
+    }
+    ::memcpy(out + x * 4, acc, sizeof(acc));
+  }
+}
+
+CHAOS_TARGET("sse4.1")
+void filterRowSse(const float* row, const Weights& xs, float* out,
+    int width) {
+  for (int x = 0; x < width; ++x) {
+    const float* p = row + xs.first[x] * 4;
+    const float* w = xs.w.data() + (size_t)x * xs.taps;
+    __m128 acc = _mm_setzero_ps();
+    for (int t = 0; t < xs.taps; ++t) {
+      acc = _mm_add_ps(
+          acc, _mm_mul_ps(_mm_loadu_ps(p + t * 4), _mm_set1_ps(w[t])));
+    }
+    _mm_storeu_ps(out + x * 4, acc);
+  }
+}
+
+// Two taps an iteration, one per lane.
+CHAOS_TARGET("avx2")
+void filterRowAvx2(const float* row, const Weights& xs, float* out,
+    int width) {
+  const __m256i spread = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+  for (int x = 0; x < width; ++x) {
+    const float* p = row + xs.first[x] * 4;
+    const float* w = xs.w.data() + (size_t)x * xs.taps;
+    __m256 acc = _mm256_setzero_ps();
+    int t = 0;
+    for (; t + 2 <= xs.taps; t += 2) {
+      const __m128 pair = _mm_castsi128_ps(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(w + t)));
+      const __m256 wv =
+          _mm256_permutevar8x32_ps(_mm256_castps128_ps256(pair), spread);
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(p + t * 4), wv));
+    }
+    __m128 sum = _mm_add_ps(
+        _mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    if (t < xs.taps) {
+      sum = _mm_add_ps(
+          sum, _mm_mul_ps(_mm_loadu_ps(p + t * 4), _mm_set1_ps(w[t])));
+    }
+    _mm_storeu_ps(out + x * 4, sum);
+  }
+}
+
+// |count| floats weighted over |taps| rows.
+void filterColumnsScalar(const float* const* rows, const float* w, int taps,
+    float* out, int count) {
+  for (int i = 0; i < count; ++i) {
+    out[i] = rows[0][i] * w[0];
+  }
+  for (int t = 1; t < taps; ++t) {
+    for (int i = 0; i < count; ++i) {
+      out[i] += rows[t][i] * w[t];
+    }
+  }
+}
+
+CHAOS_TARGET("sse4.1")
+void filterColumnsSse(const float* const* rows, const float* w, int taps,
+    float* out, int first, int count) {
+  for (int i = first; i < count; i += 4) {
+    __m128 acc = _mm_setzero_ps();
+    for (int t = 0; t < taps; ++t) {
+      acc = _mm_add_ps(
+          acc, _mm_mul_ps(_mm_loadu_ps(rows[t] + i), _mm_set1_ps(w[t])));
+    }
+    _mm_storeu_ps(out + i, acc);
+  }
+}
+
+CHAOS_TARGET("avx2")
+void filterColumnsAvx2(const float* const* rows, const float* w, int taps,
+    float* out, int count) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (int t = 0; t < taps; ++t) {
+      acc = _mm256_add_ps(acc,
+          _mm256_mul_ps(_mm256_loadu_ps(rows[t] + i), _mm256_set1_ps(w[t])));
+    }
+    _mm256_storeu_ps(out + i, acc);
+  }
+  filterColumnsSse(rows, w, taps, out, i, count);
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("sse4.1")
+void storeRowSse(const float* in, uint8_t* dst, int first, int width) {
+  for (int x = first; x < width; ++x) {
+    storePixelSse<F>(_mm_loadu_ps(in + x * 4), dst + x * kPixelSize<F>);
+  }
+}
+
+template <PixelFormat F>
+CHAOS_TARGET("avx2")
+void storeRowAvx2(const float* in, uint8_t* dst, int width) {
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    storePixelsAvx2<F>(_mm256_loadu_ps(in + x * 4),
+        _mm256_loadu_ps(in + x * 4 + 8), dst + x * kPixelSize<F>);
+  }
+  storeRowSse<F>(in, dst, x, width);
+}
+
+struct SeparableJob {
+  const uint8_t* src;
+  size_t src_stride;
+  int src_width;
+  uint8_t* dst;
+  size_t dst_stride;
+  int dst_width;
+  int dst_height;
+  Weights xs;
+  Weights ys;
+  bool linear;
+};
+
+template <PixelFormat F>
+void separableRows(
+    const SeparableJob& job, size_t y0, size_t y1, SimdLevel level) {
+  const int width = job.dst_width;
+  const int taps = job.ys.taps;
+  const int count = width * 4;
+  // Horizontally filtered source rows, as many as an output row weighs. Its
+  // rows are consecutive, so they never share a slot, and the next output
+  // row only filters the rows it adds.
+  std::vector<float> ring((size_t)taps * count);
+  std::vector<int> cached(taps, -1);
+  std::vector<const float*> rows(taps);
+  std::vector<float> line((size_t)job.src_width * 4);
+  std::vector<float> out(count);
+
+  for (size_t y = y0; y < y1; ++y) {
+    const int first = job.ys.first[y];
+    for (int t = 0; t < taps; ++t) {
+      const int sy = first + t;
+      const int slot = sy % taps;
+      float* row = ring.data() + (size_t)slot * count;
+      if (cached[slot] != sy) {
+        loadRow<F>(job.src + sy * job.src_stride, line.data(), job.src_width,
+            job.linear, level);
+        if (level == SimdLevel::AVX2) {
+          filterRowAvx2(line.data(), job.xs, row, width);
+        } else if (level == SimdLevel::SSE41) {
+          filterRowSse(line.data(), job.xs, row, width);
+        } else {
+          filterRowScalar(line.data(), job.xs, row, width);
+        }
+        cached[slot] = sy;
+      }
+      rows[t] = row;
+    }
+
+    const float* w = job.ys.w.data() + y * taps;
+    if (level == SimdLevel::AVX2) {
+      filterColumnsAvx2(rows.data(), w, taps, out.data(), count);
+    } else if (level == SimdLevel::SSE41) {
+      filterColumnsSse(rows.data(), w, taps, out.data(), 0, count);
+    } else {
+      filterColumnsScalar(rows.data(), w, taps, out.data(), count);
+    }
+    if (job.linear) {
+      encodeRow<F>(out.data(), width);
+    }
+
+    uint8_t* dst = job.dst + y * job.dst_stride;
+    if (level == SimdLevel::AVX2) {
+      storeRowAvx2<F>(out.data(), dst, width);
+    } else if (level == SimdLevel::SSE41) {
+      storeRowSse<F>(out.data(), dst, 0, width);
+    } else {
+      for (int x = 0; x < width; ++x) {
+        storePixel<F>(out.data() + x * 4, dst + x * kPixelSize<F>);
+      }
+    }
+  }
+}
+
+template <PixelFormat F>
+void halfRows(const Job& job, size_t y0, size_t y1, SimdLevel level) {
+  const int width = job.dst_width;
+  // The last column of an odd width pairs with itself.
+  const int pairs =
+      job.xs.i0[width - 1] == job.xs.i1[width - 1] ? width - 1 : width;
+  for (size_t y = y0; y < y1; ++y) {
+    const uint8_t* a = job.src + job.ys.i0[y] * job.src_stride;
+    const uint8_t* b = job.src + job.ys.i1[y] * job.src_stride;
+    uint8_t* dst = job.dst + y * job.dst_stride;
+    int x = 0;
+    if (level == SimdLevel::AVX2) {
+      halveAvx2<F>(a, b, dst, pairs);
+      x = pairs;
+    } else if (level == SimdLevel::SSE41) {
+      halveSse<F>(a, b, dst, 0, pairs);
+      x = pairs;
+    }
+    halveScalar<F>(a, b, job.xs, dst, x, width);
+  }
+}
+
+void checkArgs(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, uint8_t* dst, int dst_width, int dst_height) {
+  if (!src || !dst || src_width <= 0 || src_height <= 0 || dst_width <= 0 ||
+      dst_height <= 0) {
+    throw std::invalid_argument("invalid resize.");
+  }
+  if (format == PixelFormat::Unknown) {
+    throw std::invalid_argument("unknown format.");
+  }
+}
+
+// Only nearest copies pixels as they are, half floats must be converted to
+// RGBA32F for the filters.
+void checkFilterable(PixelFormat format) {
+  if (format == PixelFormat::RGBA16F) {
+    throw std::invalid_argument("half floats are not filterable.");
+  }
+}
+
+template <typename job_t>
+void run(job_t& job, void (*rows)(const job_t&, size_t, size_t, SimdLevel)) {
+  const SimdLevel level = activeSimdLevel();
+  const size_t grain =
+      std::max<size_t>(1, kPixelsPerChunk / (size_t)job.dst_width);
+  task::parallel_for(
+      0, job.dst_height,
+      [&](size_t y0, size_t y1) { rows(job, y0, y1, level); }, grain);
+}
+
+}  // namespace
+
+SimdLevel getSimdLevel() {
+  static const SimdLevel level = detectSimdLevel();
+  return level;
+}
+
+void setSimdLevel(SimdLevel level) {
+  g_simd_cap.store((int)level, std::memory_order_relaxed);
+}
+
+SimdLevel activeSimdLevel() {
+  return (SimdLevel)std::min(
+      (int)getSimdLevel(), g_simd_cap.load(std::memory_order_relaxed));
+}
+
+void resizeNearest(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, int dst_width,
+    int dst_height, size_t dst_stride) {
+  checkArgs(format, src, src_width, src_height, dst, dst_width, dst_height);
+  Job job{src, src_stride, dst, dst_stride, dst_width, dst_height,
+      nearestTaps(src_width, dst_width), nearestTaps(src_height, dst_height)};
+  switch (getPixelFormatSize(format)) {
+    case 4:
+      run(job, nearestRows<4>);
+      break;
+    case 8:
+      run(job, nearestRows<8>);
+      break;
+    default:
+      run(job, nearestRows<16>);
+      break;
+  }
+}
+
+void resizeBilinear(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, int dst_width,
+    int dst_height, size_t dst_stride) {
+  checkArgs(format, src, src_width, src_height, dst, dst_width, dst_height);
+  checkFilterable(format);
+  Job job{src, src_stride, dst, dst_stride, dst_width, dst_height,
+      bilinearTaps(src_width, dst_width), bilinearTaps(src_height, dst_height)};
+  switch (format) {
+    case PixelFormat::RGBA16:
+      run(job, bilinearRows<PixelFormat::RGBA16>);
+      break;
+    case PixelFormat::RGBA32F:
+      run(job, bilinearRows<PixelFormat::RGBA32F>);
+      break;
+    default:
+      // Channel order does not matter, BGRA8 goes as RGBA8.
+      run(job, bilinearRows<PixelFormat::RGBA8>);
+      break;
+  }
+}
+
+void resizeHalf(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, size_t dst_stride) {
+  const int dst_width = (src_width + 1) / 2;
+  const int dst_height = (src_height + 1) / 2;
+  checkArgs(format, src, src_width, src_height, dst, dst_width, dst_height);
+  checkFilterable(format);
+  Job job{src, src_stride, dst, dst_stride, dst_width, dst_height,
+      halfTaps(src_width), halfTaps(src_height)};
+  switch (format) {
+    case PixelFormat::RGBA16:
+      run(job, halfRows<PixelFormat::RGBA16>);
+      break;
+    case PixelFormat::RGBA32F:
+      run(job, halfRows<PixelFormat::RGBA32F>);
+      break;
+    default:
+      run(job, halfRows<PixelFormat::RGBA8>);
+      break;
+  }
+}
+
+std::vector<uint8_t> resizeHalves(PixelFormat format, const uint8_t* src,
+    int& width, int& height, size_t src_stride, int levels) {
+  std::vector<uint8_t> buf;
+  for (int i = 0; i < levels && (width > 1 || height > 1); ++i) {
+    const int half_width = (width + 1) / 2;
+    const int half_height = (height + 1) / 2;
+    const size_t stride = getPixelFormatSize(format) * (size_t)half_width;
+    std::vector<uint8_t> half(stride * half_height);
+    resizeHalf(format, src, width, height, src_stride, half.data(), stride);
+    buf = std::move(half);
+    src = buf.data();
+    src_stride = stride;
+    width = half_width;
+    height = half_height;
+  }
+  return buf;
+}
+
+void resizeSeparable(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, int dst_width,
+    int dst_height, size_t dst_stride, ResizeFilter filter,
+    bool linear_light) {
+  checkArgs(format, src, src_width, src_height, dst, dst_width, dst_height);
+  checkFilterable(format);
+  if (filter != ResizeFilter::Box && filter != ResizeFilter::Mitchell &&
+      filter != ResizeFilter::Lanczos3) {
+    throw std::invalid_argument("not a separable filter.");
+  }
+  SeparableJob job{src, src_stride, src_width, dst, dst_stride, dst_width,
+      dst_height, filterWeights(filter, src_width, dst_width),
+      filterWeights(filter, src_height, dst_height), linear_light};
+  switch (format) {
+    case PixelFormat::RGBA16:
+      run(job, separableRows<PixelFormat::RGBA16>);
+      break;
+    case PixelFormat::RGBA32F:
+      run(job, separableRows<PixelFormat::RGBA32F>);
+      break;
+    default:
+      run(job, separableRows<PixelFormat::RGBA8>);
+      break;
+  }
+}
+
+}  // namespace chaos
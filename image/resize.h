@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+// MSVC compiles any intrinsic, GCC and Clang need the target per function.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CHAOS_TARGET(arch)
+#else
+#define CHAOS_TARGET(arch) __attribute__((target(arch)))
+#endif
+
+namespace chaos {
+
+// AVX2 includes F16C.
+enum class SimdLevel { Scalar = 0, SSE41 = 1, AVX2 = 2 };
+
+// Highest level the CPU and OS support, detected once.
+SimdLevel getSimdLevel();
+// Caps the level the image kernels use, e.g. to compare them. Levels above
+// getSimdLevel() are ignored.
+void setSimdLevel(SimdLevel level);
+// Level the kernels run at.
+SimdLevel activeSimdLevel();
+
+// Resample |src| into |dst|, both packed pixels of |format| with rows
+// |src_stride| and |dst_stride| bytes apart, splitting rows over the parallel
+// queue. Pixel centers are aligned, so the corners map onto each other.
+void resizeNearest(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, int dst_width,
+    int dst_height, size_t dst_stride);
+void resizeBilinear(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, int dst_width,
+    int dst_height, size_t dst_stride);
+// Halves |src| with a 2x2 box into |dst| of (|src_width| + 1) / 2 by
+// (|src_height| + 1) / 2 pixels. The last column or row of odd sizes is
+// averaged with itself. Integers round half up.
+void resizeHalf(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, size_t dst_stride);
+// resizeHalf() |levels| times into packed rows, updating |width| and
+// |height|. Only the last two levels are held at once, nothing is returned
+// for zero levels.
+std::vector<uint8_t> resizeHalves(PixelFormat format, const uint8_t* src,
+    int& width, int& height, size_t src_stride, int levels);
+// Polyphase resampling with precomputed weights for the separable filters,
+// rows are filtered horizontally into a ring shared by the output rows which
+// overlap them, then vertically. With |linear_light| the color channels are
+// decoded from sRGB first and encoded again after, alpha stays as is.
+void resizeSeparable(PixelFormat format, const uint8_t* src, int src_width,
+    int src_height, size_t src_stride, uint8_t* dst, int dst_width,
+    int dst_height, size_t dst_stride, ResizeFilter filter,
+    bool linear_light = false);
+
+}  // namespace chaos
@@ -3,6 +3,8 @@
 #include "base/fs.h"
 #include "base/text.h"
 
+#include "resize.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -75,9 +77,16 @@ std::unique_ptr<Image> StbRW::Read(const std::string& path, int pos,
     return nullptr;
   }
 
-  const size_t size = stride * y;
-  std::vector<uint8_t> buffer(size);
-  ::memcpy(buffer.data(), data, size);
+  // stb decodes at full size only, halve before copying it out.
+  std::vector<uint8_t> buffer;
+  const int level = decodeLevelFor(x, y, prefer_width, prefer_height);
+  if (level > 0) {
+    buffer = resizeHalves(format, (const uint8_t*)data, x, y, stride, level);
+    stride = getPixelFormatSize(format) * x;
+  } else {
+    buffer.resize(stride * y);
+    ::memcpy(buffer.data(), data, buffer.size());
+  }
   stbi_image_free(data);
 
   std::unique_ptr<Image> image(new Image(x, y, stride, format, 3, cs, std::move(buffer)));
@@ -89,11 +98,15 @@ std::vector<uint8_t> StbRW::Write(
   std::vector<uint8_t> buf;
 
   if (format == "png") {
-    std::unique_ptr<Image> converted = image->Convert(PixelFormat::RGBA8);
-
-    stbi_write_png("e:\\test.png", converted->width(), converted->height(),
-        getPixelFormatChannels(converted->format()), converted->data(),
-        (int)converted->stride());
+    // stb writes straight sRGB bytes.
+    std::unique_ptr<Image> converted;
+    if (image->format() != PixelFormat::RGBA8 ||
+        image->colorspace() != ColorSpace::sRGB ||
+        image->alpha_mode() != AlphaMode::Straight) {
+      converted = image->Convert(
+          PixelFormat::RGBA8, ColorSpace::sRGB, AlphaMode::Straight);
+      image = converted.get();
+    }
 
     int ret = stbi_write_png_to_func(
         [](void* ctx, void* data, int size) {
@@ -101,9 +114,9 @@ std::vector<uint8_t> StbRW::Write(
           buf->resize(size);
           ::memcpy(buf->data(), data, size);
         },
-        &buf, converted->width(), converted->height(),
-        getPixelFormatChannels(converted->format()), converted->data(),
-        (int)converted->stride());
+        &buf, image->width(), image->height(),
+        getPixelFormatChannels(image->format()), image->data(),
+        (int)image->stride());
     if (ret) {
       return std::move(buf);
     }
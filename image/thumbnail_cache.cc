@@ -0,0 +1,471 @@
+#include "thumbnail_cache.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "base/fs.h"
+#include "base/minlog.h"
+
+namespace chaos {
+
+namespace {
+
+constexpr uint32_t kPackMagic = 0x4b505443;    // "CTPK"
+constexpr uint32_t kRecordMagic = 0x42485443;  // "CTHB"
+constexpr uint32_t kPackVersion = 1;
+// Pixels start on cache-line boundaries.
+constexpr uint64_t kAlignment = 64;
+constexpr uint32_t kMaxPathSize = 32 * 1024;
+// Smaller packs are not worth rewriting.
+constexpr uint64_t kCompactionMinSize = 64 * 1024 * 1024;
+constexpr const char* kCompactionQueueId = "thumbnails";
+
+struct PackHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t reserved[7];
+};
+static_assert(sizeof(PackHeader) == kAlignment);
+
+// Followed by the path, then the pixels at the next aligned offset.
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t path_size;
+  // Of the header with this field zeroed, and the path.
+  uint64_t header_sum;
+  uint64_t data_sum;
+  uint64_t data_size;
+  int64_t modified;
+  int32_t size;
+  int32_t width;
+  int32_t height;
+  uint32_t stride;
+  uint32_t format;
+  uint32_t channels;
+  uint32_t colorspace;
+  // Zero, straight, in packs written before it was recorded.
+  uint32_t alpha;
+};
+static_assert(sizeof(RecordHeader) == 72);
+
+constexpr uint64_t align(uint64_t n) {
+  return (n + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+uint64_t dataOffset(const RecordHeader& header) {
+  return align(sizeof(RecordHeader) + header.path_size);
+}
+
+uint64_t recordLength(const RecordHeader& header) {
+  return align(dataOffset(header) + header.data_size);
+}
+
+// Word-at-a-time multiply-rotate hash. Catches torn and garbled writes at
+// memory speed, it is no defence against deliberate tampering.
+uint64_t checksum(const uint8_t* data, size_t size, uint64_t seed = 0) {
+  constexpr uint64_t k1 = 0x87c37b91114253d5ULL;
+  constexpr uint64_t k2 = 0x4cf5ad432745937fULL;
+  uint64_t h = seed ^ (size * k1);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    ::memcpy(&word, data + i, 8);
+    h = (std::rotl(h ^ (word * k1), 31) + k2) * k1;
+  }
+  for (; i < size; ++i) {
+    h = (std::rotl(h ^ (data[i] * k2), 31) + k1) * k1;
+  }
+  h ^= h >> 33;
+  h *= k2;
+  h ^= h >> 29;
+  return h;
+}
+
+uint64_t headerSum(RecordHeader header, const char* path) {
+  header.header_sum = 0;
+  const uint64_t sum =
+      checksum(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+  return checksum(
+      reinterpret_cast<const uint8_t*>(path), header.path_size, sum);
+}
+
+std::string indexKey(const std::string& path, int size) {
+  std::string key = path;
+  key.push_back('\0');
+  key += std::to_string(size);
+  return key;
+}
+
+void writeZeros(std::ostream& out, uint64_t count) {
+  static const char kZeros[kAlignment] = {};
+  out.write(kZeros, count);
+}
+
+}  // namespace
+
+ThumbnailCache::ThumbnailCache(const std::string& directory)
+    : directory_(directory),
+      generation_(0),
+      file_size_(0),
+      garbage_(0),
+      compacting_(false) {
+  open();
+}
+
+ThumbnailCache::~ThumbnailCache() {
+  if (compaction_.valid()) {
+    compaction_.wait();
+  }
+}
+
+std::filesystem::path ThumbnailCache::packPath(
+    uint64_t generation, const char* extension) const {
+  return directory_ / ("thumbs." + std::to_string(generation) + extension);
+}
+
+void ThumbnailCache::open() {
+  std::error_code ec;
+  std::filesystem::create_directories(directory_, ec);
+  if (ec) {
+    throw std::runtime_error("failed to create " + directory_.string() + ".");
+  }
+
+  // Packs of all generations, newest first. Leftovers of an interrupted
+  // compaction are dropped.
+  std::vector<std::pair<uint64_t, std::filesystem::path>> packs;
+  for (const auto& entry :
+      std::filesystem::directory_iterator(directory_, ec)) {
+    const std::filesystem::path& path = entry.path();
+    const std::string stem = path.stem().string();
+    if (stem.rfind("thumbs.", 0) != 0) {
+      continue;
+    }
+    if (path.extension() == ".tmp") {
+      std::filesystem::remove(path, ec);
+    } else if (path.extension() == ".pack") {
+      try {
+        packs.emplace_back(std::stoull(stem.substr(7)), path);
+      } catch (const std::exception&) {
+      }
+    }
+  }
+  std::sort(packs.begin(), packs.end(),
+      [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+
+  bool loaded = false;
+  for (const auto& [generation, path] : packs) {
+    if (!loaded && load(path)) {
+      generation_ = generation;
+      loaded = true;
+    } else {
+      std::filesystem::remove(path, ec);
+    }
+  }
+  if (!loaded) {
+    generation_ = packs.empty() ? 1 : packs.front().first + 1;
+    create(packPath(generation_));
+  }
+
+  writer_.open(packPath(generation_), std::ios::binary | std::ios::app);
+  if (!writer_) {
+    throw std::runtime_error("failed to open thumbnail pack.");
+  }
+}
+
+bool ThumbnailCache::load(const std::filesystem::path& path) {
+  uint64_t end = 0;
+  {
+    std::unique_ptr<MappedFile> file;
+    try {
+      file = std::make_unique<MappedFile>(path.string());
+    } catch (const std::exception& ex) {
+      LOG_F(WARNING, "failed to map %s: %s", path.string().c_str(), ex.what());
+      return false;
+    }
+
+    PackHeader pack;
+    if (file->size() < sizeof(pack)) {
+      return false;
+    }
+    ::memcpy(&pack, file->data(), sizeof(pack));
+    if (pack.magic != kPackMagic || pack.version != kPackVersion) {
+      return false;
+    }
+
+    // Stops at the first record which is cut short or garbled, anything
+    // after it was being written when the process died.
+    end = sizeof(pack);
+    while (file->size() - end >= sizeof(RecordHeader)) {
+      RecordHeader header;
+      ::memcpy(&header, file->data() + end, sizeof(header));
+      if (header.magic != kRecordMagic || header.path_size > kMaxPathSize ||
+          file->size() - end < sizeof(header) + header.path_size) {
+        break;
+      }
+      const char* record_path =
+          reinterpret_cast<const char*>(file->data() + end + sizeof(header));
+      if (headerSum(header, record_path) != header.header_sum ||
+          header.data_size > file->size() - end ||
+          recordLength(header) > file->size() - end) {
+        break;
+      }
+
+      const uint64_t length = recordLength(header);
+      auto [it, inserted] = index_.try_emplace(indexKey(
+          std::string(record_path, header.path_size), header.size));
+      if (!inserted) {
+        garbage_ += it->second.length;
+      }
+      it->second = {end, length, header.modified, false};
+      end += length;
+    }
+
+    if (end < file->size()) {
+      LOG_F(WARNING, "dropped %llu bytes of torn records in %s.",
+          (unsigned long long)(file->size() - end), path.string().c_str());
+    }
+  }
+
+  // Only once unmapped, a mapped file cannot shrink.
+  std::error_code ec;
+  if (std::filesystem::file_size(path, ec) > end) {
+    std::filesystem::resize_file(path, end, ec);
+    if (ec) {
+      index_.clear();
+      garbage_ = 0;
+      return false;
+    }
+  }
+  file_size_ = end;
+  return true;
+}
+
+void ThumbnailCache::create(const std::filesystem::path& path) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  PackHeader pack{kPackMagic, kPackVersion};
+  out.write(reinterpret_cast<const char*>(&pack), sizeof(pack));
+  out.flush();
+  if (!out) {
+    throw std::runtime_error("failed to create thumbnail pack.");
+  }
+  file_size_ = sizeof(pack);
+}
+
+const MappedFile* ThumbnailCache::map(uint64_t end) {
+  // Appends are not visible through an older mapping, views handed out keep
+  // theirs alive.
+  if (!mapping_ || mapping_->size() < end) {
+    mapping_ = std::make_shared<MappedFile>(packPath(generation_).string());
+  }
+  return mapping_.get();
+}
+
+std::unique_ptr<Image> ThumbnailCache::Get(
+    const std::string& path, int size, Time modified) {
+  std::lock_guard lock(mutex_);
+  auto it = index_.find(indexKey(path, size));
+  if (it == index_.end() ||
+      it->second.modified != modified.time_since_epoch().count()) {
+    stats_.misses++;
+    return nullptr;
+  }
+
+  Entry& entry = it->second;
+  const uint8_t* record =
+      map(entry.offset + entry.length)->data() + entry.offset;
+  RecordHeader header;
+  ::memcpy(&header, record, sizeof(header));
+  const uint8_t* pixels = record + dataOffset(header);
+  if (!entry.verified) {
+    if (checksum(pixels, header.data_size) != header.data_sum) {
+      LOG_F(WARNING, "dropped damaged thumbnail of %s.", path.c_str());
+      garbage_ += entry.length;
+      index_.erase(it);
+      stats_.misses++;
+      return nullptr;
+    }
+    entry.verified = true;
+  }
+  stats_.hits++;
+
+  return std::make_unique<Image>(header.width, header.height, header.stride,
+      (PixelFormat)header.format, header.channels,
+      (ColorSpace)header.colorspace,
+      std::shared_ptr<const uint8_t>(mapping_, pixels), header.data_size,
+      (AlphaMode)header.alpha);
+}
+
+void ThumbnailCache::Put(const std::string& path, int size, Time modified,
+    const Image& image) {
+  if (path.size() > kMaxPathSize) {
+    throw std::invalid_argument("path too long.");
+  }
+
+  RecordHeader header{};
+  header.magic = kRecordMagic;
+  header.path_size = (uint32_t)path.size();
+  header.data_sum = checksum(image.data(), image.size());
+  header.data_size = image.size();
+  header.modified = modified.time_since_epoch().count();
+  header.size = size;
+  header.width = image.width();
+  header.height = image.height();
+  header.stride = (uint32_t)image.stride();
+  header.format = (uint32_t)image.format();
+  header.channels = image.channels();
+  header.colorspace = (uint32_t)image.colorspace();
+  header.alpha = (uint32_t)image.alpha_mode();
+  header.header_sum = headerSum(header, path.c_str());
+  const uint64_t offset = dataOffset(header);
+  const uint64_t length = recordLength(header);
+
+  std::lock_guard lock(mutex_);
+  writer_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writer_.write(path.data(), path.size());
+  writeZeros(writer_, offset - sizeof(header) - path.size());
+  writer_.write(reinterpret_cast<const char*>(image.data()), image.size());
+  writeZeros(writer_, length - offset - image.size());
+  writer_.flush();
+  if (!writer_) {
+    // The partial record is cut off on the next open.
+    throw std::runtime_error("failed to write thumbnail pack.");
+  }
+
+  auto [it, inserted] = index_.try_emplace(indexKey(path, size));
+  if (!inserted) {
+    garbage_ += it->second.length;
+  }
+  it->second = {file_size_, length, header.modified, true};
+  file_size_ += length;
+
+  if (file_size_ >= kCompactionMinSize && garbage_ > file_size_ / 2) {
+    scheduleCompaction();
+  }
+}
+
+void ThumbnailCache::Compact() {
+  std::lock_guard lock(mutex_);
+  scheduleCompaction();
+}
+
+void ThumbnailCache::scheduleCompaction() {
+  if (compacting_) {
+    return;
+  }
+  compacting_ = true;
+  compaction_ =
+      task::dispatchAsync(kCompactionQueueId, [this](std::atomic<bool>&) {
+        try {
+          compact();
+        } catch (const std::exception& ex) {
+          LOG_F(WARNING, "failed to compact thumbnails: %s", ex.what());
+        }
+        std::lock_guard lock(mutex_);
+        compacting_ = false;
+      });
+}
+
+void ThumbnailCache::compact() {
+  // Copies the live records as of now without the lock, Get() and Put() go on
+  // with the current pack meanwhile.
+  std::shared_ptr<MappedFile> source;
+  std::vector<std::pair<uint64_t, uint64_t>> records;
+  uint64_t generation = 0;
+  {
+    std::lock_guard lock(mutex_);
+    map(file_size_);
+    source = mapping_;
+    generation = generation_;
+    records.reserve(index_.size());
+    for (const auto& [key, entry] : index_) {
+      records.emplace_back(entry.offset, entry.length);
+    }
+  }
+  std::sort(records.begin(), records.end());
+
+  const std::filesystem::path tmp = packPath(generation + 1, ".tmp");
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  PackHeader pack{kPackMagic, kPackVersion};
+  out.write(reinterpret_cast<const char*>(&pack), sizeof(pack));
+  std::unordered_map<uint64_t, uint64_t> moved;
+  uint64_t end = sizeof(pack);
+  for (const auto& [offset, length] : records) {
+    out.write(reinterpret_cast<const char*>(source->data() + offset), length);
+    moved.emplace(offset, end);
+    end += length;
+  }
+  source.reset();
+
+  // Records put since then go last, under the lock so no more arrive.
+  std::lock_guard lock(mutex_);
+  const MappedFile* current = map(file_size_);
+  std::vector<std::pair<Entry*, uint64_t>> updates;
+  updates.reserve(index_.size());
+  uint64_t live = 0;
+  for (auto& [key, entry] : index_) {
+    auto it = moved.find(entry.offset);
+    if (it != moved.end()) {
+      updates.emplace_back(&entry, it->second);
+    } else {
+      out.write(reinterpret_cast<const char*>(current->data() + entry.offset),
+          entry.length);
+      updates.emplace_back(&entry, end);
+      end += entry.length;
+    }
+    live += entry.length;
+  }
+  out.close();
+
+  std::error_code ec;
+  if (!out) {
+    std::filesystem::remove(tmp, ec);
+    throw std::runtime_error("failed to write " + tmp.string() + ".");
+  }
+  writer_.close();
+  std::filesystem::rename(tmp, packPath(generation + 1), ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    writer_.open(packPath(generation_), std::ios::binary | std::ios::app);
+    throw std::runtime_error("failed to replace thumbnail pack.");
+  }
+
+  // Views of the old pack stay valid, its file goes once they are released.
+  mapping_.reset();
+  std::filesystem::remove(packPath(generation_), ec);
+  generation_ = generation + 1;
+  for (auto& [entry, offset] : updates) {
+    entry->offset = offset;
+  }
+  file_size_ = end;
+  garbage_ = end - sizeof(pack) - live;
+  writer_.open(packPath(generation_), std::ios::binary | std::ios::app);
+  if (!writer_) {
+    throw std::runtime_error("failed to open thumbnail pack.");
+  }
+}
+
+size_t ThumbnailCache::size() const {
+  std::lock_guard lock(mutex_);
+  return index_.size();
+}
+
+uint64_t ThumbnailCache::file_size() const {
+  std::lock_guard lock(mutex_);
+  return file_size_;
+}
+
+uint64_t ThumbnailCache::garbage() const {
+  std::lock_guard lock(mutex_);
+  return garbage_;
+}
+
+CacheStats ThumbnailCache::stats() const {
+  std::lock_guard lock(mutex_);
+  CacheStats stats = stats_;
+  stats.entries = index_.size();
+  stats.bytes = file_size_ - garbage_ - sizeof(PackHeader);
+  return stats;
+}
+
+}  // namespace chaos
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "image.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/container.h"
+#include "base/task.h"
+
+namespace chaos {
+
+class MappedFile;
+
+// Persistent store of decoded thumbnails keyed by (path, size, mtime). New
+// thumbnails are appended to a pack file which is mapped for reading, so Get()
+// returns views of the mapping without copying. The index is rebuilt from the
+// record headers on open.
+//
+// Records carry checksums: a tail torn by a crash is cut off on open, and
+// damaged pixels are dropped when first read. Superseded records are reclaimed
+// by rewriting the live ones into the next generation of the pack on a
+// background queue. Thread-safe.
+class ThumbnailCache {
+ public:
+  using Time = std::chrono::system_clock::time_point;
+
+  // Opens or creates the store in |directory|.
+  explicit ThumbnailCache(const std::string& directory);
+  ~ThumbnailCache();
+
+  ThumbnailCache(const ThumbnailCache&) = delete;
+  ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+  // Null when missing, damaged, or stored for another |modified| time of the
+  // source file. The view keeps its part of the pack mapped.
+  std::unique_ptr<Image> Get(const std::string& path, int size, Time modified);
+  // Replaces any thumbnail stored for |path| and |size|.
+  void Put(const std::string& path, int size, Time modified,
+      const Image& image);
+
+  // Starts rewriting the pack without its garbage unless already running.
+  // Happens by itself once garbage makes up half of a large pack.
+  void Compact();
+
+  size_t size() const;
+  // Bytes of the pack, and of the superseded or damaged records in it.
+  uint64_t file_size() const;
+  uint64_t garbage() const;
+  // Bytes are those of the live records. Entries are never evicted and their
+  // age is not tracked across sessions.
+  CacheStats stats() const;
+
+ private:
+  struct Entry {
+    uint64_t offset;
+    uint64_t length;
+    int64_t modified;
+    // Pixels checked against their checksum.
+    bool verified;
+  };
+
+  std::filesystem::path packPath(uint64_t generation,
+      const char* extension = ".pack") const;
+  void open();
+  bool load(const std::filesystem::path& path);
+  void create(const std::filesystem::path& path);
+  const MappedFile* map(uint64_t end);
+  void scheduleCompaction();
+  void compact();
+
+ private:
+  std::filesystem::path directory_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> index_;
+  std::shared_ptr<MappedFile> mapping_;
+  std::ofstream writer_;
+  uint64_t generation_;
+  uint64_t file_size_;
+  uint64_t garbage_;
+  bool compacting_;
+  task::Future<void> compaction_;
+  CacheStats stats_;
+};
+
+}  // namespace chaos
@@ -79,16 +79,33 @@ std::unique_ptr<Image> WicRW::Read(const std::string& path, int pos,
     PixelFormat format = PixelFormat::RGBA8;
     ColorSpace cs = ColorSpace::sRGB;
 
+    // The scaler pulls from IWICBitmapSourceTransform where the codec has
+    // one, which JPEG implements with 1/2, 1/4 and 1/8 DCT scaling.
+    ComPtr<IWICBitmapSource> source = bitmap_frame;
+    UINT frame_width, frame_height;
+    CHECK(bitmap_frame->GetSize(&frame_width, &frame_height));
+    const int level = decodeLevelFor(
+        frame_width, frame_height, prefer_width, prefer_height);
+    if (level > 0) {
+      const UINT mask = (1u << level) - 1;
+      ComPtr<IWICBitmapScaler> scaler;
+      CHECK(factory->CreateBitmapScaler(&scaler));
+      CHECK(scaler->Initialize(bitmap_frame.Get(),
+          (frame_width + mask) >> level, (frame_height + mask) >> level,
+          WICBitmapInterpolationModeFant));
+      source = scaler;
+    }
+
     ComPtr<IWICFormatConverter> converter;
     CHECK(factory->CreateFormatConverter(&converter));
     if (bpp > 32) {
-      CHECK(converter->Initialize(bitmap_frame.Get(),
+      CHECK(converter->Initialize(source.Get(),
           GUID_WICPixelFormat128bppRGBAFloat, WICBitmapDitherTypeNone, nullptr,
           0.0f, WICBitmapPaletteTypeCustom));
       format = PixelFormat::RGBA32F;
       cs = ColorSpace::Linear;
     } else {
-      CHECK(converter->Initialize(bitmap_frame.Get(),
+      CHECK(converter->Initialize(source.Get(),
           GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr,
           0.0f, WICBitmapPaletteTypeCustom));
     }
@@ -46,13 +46,29 @@ std::unique_ptr<Image> WinRTRW::Read(const std::string& path, int pos,
       IRandomAccessStream stream = sf.OpenAsync(FileAccessMode::Read).get();
 
       BitmapDecoder decoder = BitmapDecoder::CreateAsync(stream).get();
-      SoftwareBitmap software_bitmap = decoder.GetSoftwareBitmapAsync().get();
-      if (software_bitmap.BitmapPixelFormat() != BitmapPixelFormat::Rgba8 ||
-          software_bitmap.BitmapAlphaMode() == BitmapAlphaMode::Straight) {
-        software_bitmap = SoftwareBitmap::Convert(software_bitmap,
-            BitmapPixelFormat::Rgba8, BitmapAlphaMode::Premultiplied);
+
+      // Halving commutes with the EXIF rotation. The JPEG codec scales by
+      // 1/2, 1/4 and 1/8 in the DCT, the rest is filtered on the way out.
+      // Embedded profiles are converted to sRGB, which the image is tagged
+      // with.
+      BitmapTransform transform;
+      const int level = decodeLevelFor(decoder.OrientedPixelWidth(),
+          decoder.OrientedPixelHeight(), prefer_width, prefer_height);
+      if (level > 0) {
+        const uint32_t mask = (1u << level) - 1;
+        transform.ScaledWidth((decoder.PixelWidth() + mask) >> level);
+        transform.ScaledHeight((decoder.PixelHeight() + mask) >> level);
+        transform.InterpolationMode(BitmapInterpolationMode::Fant);
       }
 
+      SoftwareBitmap software_bitmap =
+          decoder
+              .GetSoftwareBitmapAsync(BitmapPixelFormat::Rgba8,
+                  BitmapAlphaMode::Premultiplied, transform,
+                  ExifOrientationMode::RespectExifOrientation,
+                  ColorManagementMode::ColorManageToSRgb)
+              .get();
+
       w = software_bitmap.PixelWidth();
       h = software_bitmap.PixelHeight();
       stride = w * 4;
@@ -76,7 +92,9 @@ std::unique_ptr<Image> WinRTRW::Read(const std::string& path, int pos,
     return nullptr;
   }
 
-  return std::unique_ptr<Image>(new Image(w, h, stride, PixelFormat::RGBA8, 4, ColorSpace::sRGB, std::move(buffer)));
+  // Decoded premultiplied, see GetSoftwareBitmapAsync() above.
+  return std::unique_ptr<Image>(new Image(w, h, stride, PixelFormat::RGBA8, 4,
+      ColorSpace::sRGB, std::move(buffer), AlphaMode::Premultiplied));
 }
 
 }  // namespace chaos
@@ -61,26 +61,45 @@ project (name)
     filter { "files:**.fs.hlsl" }
         buildcommands { "dxc -T ps_6_5 %{file.relpath} -Zpr -Fh " .. shader_header_path .. " -Vn " .. shader_variable_name }
 
-project (name .. ".examples.helloworld")
-    dependson {name}
+-- Console programs in examples/<dir>, linked against the library.
+function example(dir)
+    project (name .. ".examples." .. dir)
+        dependson {name}
 
-    kind "ConsoleApp"
-    files { "examples/helloworld/*.*" }
-    links { "build/bin/%{cfg.platform}/%{cfg.buildcfg}/" .. name .. ".lib" }
-    includedirs { "./" }
+        kind "ConsoleApp"
+        files { "examples/" .. dir .. "/*.*" }
+        links { "build/bin/%{cfg.platform}/%{cfg.buildcfg}/" .. name .. ".lib" }
+        includedirs { "./" }
 
-    location "build"
-    objdir "build/obj/%{cfg.platform}/%{cfg.buildcfg}"
-    targetdir "build/bin/%{cfg.platform}/%{cfg.buildcfg}"
+        location "build"
+        objdir "build/obj/%{cfg.platform}/%{cfg.buildcfg}"
+        targetdir "build/bin/%{cfg.platform}/%{cfg.buildcfg}"
 
-    filter { "platforms:x64" }
-        system "Windows"
-        architecture "x86_64"
-        buildoptions { "/execution-charset:utf-8" }
-    filter { "configurations:Debug" }
-        defines { "_DEBUG" }
-        optimize "Debug"
-        symbols "On"
-    filter { "configurations:Release" }
-        defines { "NDEBUG" }
-        optimize "Speed"
+        filter { "platforms:x64" }
+            system "Windows"
+            architecture "x86_64"
+            buildoptions { "/execution-charset:utf-8" }
+        filter { "configurations:Debug" }
+            defines { "_DEBUG" }
+            optimize "Debug"
+            symbols "On"
+        filter { "configurations:Release" }
+            defines { "NDEBUG" }
+            optimize "Speed"
+        filter {}
+end
+
+example "helloworld"
+example "cachereplay"
+-- Benchmarks, run the Release builds.
+example "dispatchbench"
+example "coroutinebench"
+example "parallelbench"
+example "submitbench"
+example "lookupbench"
+example "cachebench"
+example "lrubench"
+example "resizebench"
+example "resamplebench"
+-- Checks, exit with 1 on failure.
+example "decodesize"